@@ -0,0 +1,169 @@
+#include "AdjacencyScaler.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+
+#include <ck2/FileLocation.h>
+#include "filesystem.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+AdjacencyScaler::AdjacencyScaler(const ProvSegmentMap& scaled_map, uint scale_x, uint scale_y)
+: _M_map(scaled_map)
+, _M_scale_x(scale_x)
+, _M_scale_y(scale_y)
+, _M_snap_radius(4 * std::max(scale_x, scale_y)) // source coordinates are often a pixel or two off already
+, _M_n_points(0)
+, _M_n_snapped(0)
+, _M_n_unresolved(0)
+{
+  assert(scale_x > 0 && scale_y > 0);
+}
+
+
+void AdjacencyScaler::scale(AdjacenciesFile& adj_file)
+{
+  for (auto& adj : adj_file)
+  {
+    // (scale_point() overwrites the points, but they're reported as given in the source adjacencies)
+    const int start_x = adj.start_x, start_y = adj.start_y;
+    const int stop_x = adj.stop_x, stop_y = adj.stop_y;
+
+    if (!scale_point(adj.start_x, adj.start_y, static_cast<prov_id_t>(adj.from)))
+      fmt::print(stderr, "Warning: adjacency {} -> {} ({}): start point ({}, {}) is not on province {}\n",
+                 adj.from, adj.to, adj.comment, start_x, start_y, adj.from);
+
+    if (!scale_point(adj.stop_x, adj.stop_y, static_cast<prov_id_t>(adj.to)))
+      fmt::print(stderr, "Warning: adjacency {} -> {} ({}): stop point ({}, {}) is not on province {}\n",
+                 adj.from, adj.to, adj.comment, stop_x, stop_y, adj.to);
+  }
+}
+
+
+bool AdjacencyScaler::scale_point(int& x, int& y, prov_id_t id)
+{
+  // -1 (or any negative coordinate) means "let the game pick the point", which stays valid at any scale.
+  if (x < 0 || y < 0)
+    return true;
+
+  ++_M_n_points;
+
+  // Map the source pixel to the center of the block of pixels it became.
+  auto new_x = std::min(static_cast<uint>(x) * _M_scale_x + _M_scale_x / 2, _M_map.width() - 1);
+  auto new_y = std::min(static_cast<uint>(y) * _M_scale_y + _M_scale_y / 2, _M_map.height() - 1);
+  uint map_x = new_x;
+  uint map_y = _M_map.height() - 1 - new_y;
+
+  if (_M_map.id_at(map_x, map_y) != id)
+  {
+    if (!find_nearest(id, map_x, map_y))
+    {
+      ++_M_n_unresolved;
+      x = static_cast<int>(new_x);
+      y = static_cast<int>(new_y);
+      return false;
+    }
+
+    ++_M_n_snapped;
+  }
+
+  x = static_cast<int>(map_x);
+  y = static_cast<int>(_M_map.height() - 1 - map_y);
+  return true;
+}
+
+
+bool AdjacencyScaler::find_nearest(prov_id_t id, uint& x, uint& y) const
+{
+  const auto r = _M_snap_radius;
+  const uint y_min = (y > r) ? y - r : 0;
+  const uint y_max = std::min(y + r, _M_map.height() - 1);
+  const uint x_min = (x > r) ? x - r : 0;
+  const uint x_max = std::min(x + r, _M_map.width() - 1);
+
+  auto best_dist = std::numeric_limits<unsigned long long>::max();
+  uint best_x = 0, best_y = 0;
+
+  for (uint cy = y_min; cy <= y_max; ++cy)
+  {
+    const unsigned long long dy = (cy > y) ? cy - y : y - cy;
+
+    if (dy * dy >= best_dist)
+      continue;
+
+    const auto& row = _M_map[cy];
+
+    // Skip directly to the first segment which reaches into the search window.
+    auto it = std::upper_bound(row.begin(), row.end(), x_min,
+                               [](uint x_, const auto& seg) { return x_ < seg.end; });
+    uint start_x = (it == row.begin()) ? 0 : std::prev(it)->end;
+
+    for (; it != row.end() && start_x <= x_max; start_x = it->end, ++it)
+    {
+      if (it->id != id)
+        continue;
+
+      // Closest pixel of this segment to x
+      uint cx = std::clamp(x, start_x, static_cast<uint>(it->end) - 1);
+      const unsigned long long dx = (cx > x) ? cx - x : x - cx;
+
+      if (auto dist = dx * dx + dy * dy; dist < best_dist)
+      {
+        best_dist = dist;
+        best_x = cx;
+        best_y = cy;
+      }
+    }
+  }
+
+  if (best_dist == std::numeric_limits<unsigned long long>::max())
+    return false;
+
+  x = best_x;
+  y = best_y;
+  return true;
+}
+
+
+void AdjacencyScaler::print_summary(FILE* f) const
+{
+  fmt::print(f, "Adjacencies: {} points rescaled, {} snapped onto their province, {} unresolved\n",
+             _M_n_points, _M_n_snapped, _M_n_unresolved);
+}
+
+
+void AdjacencyScaler::write(const AdjacenciesFile& adj_file, const fs::path& path)
+{
+  const auto ferr = FLErrorStaticFactory(FLoc(path));
+
+  unique_fptr ufp( std::fopen(path.string().c_str(), "wb"), std::fclose );
+
+  if (!ufp)
+    throw ferr("Failed to open file for writing: {}", strerror(errno));
+
+  auto f = ufp.get();
+  fmt::print(f, "From;To;Type;Through;start_x;start_y;stop_x;stop_y;Comment\n");
+
+  for (const auto& adj : adj_file)
+    fmt::print(f, "{};{};{};{};{};{};{};{};{}\n",
+               adj.from, adj.to, adj.type, adj.through,
+               adj.start_x, adj.start_y, adj.stop_x, adj.stop_y, adj.comment);
+
+  // The game stops reading at the first row with a From of -1, and it's customary to include it explicitly.
+  fmt::print(f, "-1;-1;;-1;-1;-1;-1;-1;-1\n");
+
+  if (ferror(f))
+    throw ferr("Failed to write adjacencies");
+
+  if (auto fp = ufp.release(); fclose(fp) != 0)
+    throw ferr("Failed to complete writing file: {}", strerror(errno));
+}
+
+
+//NAMESPACE_CK2_END;
@@ -0,0 +1,63 @@
+#ifndef MAPSCALER_ADJACENCY_SCALER_H
+#define MAPSCALER_ADJACENCY_SCALER_H
+
+#include <cstdio>
+
+#include <ck2/AdjacenciesFile.h>
+#include "SegmentMap.h"
+#include "common.h"
+#include "filesystem.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2; // until it is actually in the lib
+
+
+// Transforms the pixel coordinates of every adjacency (strait) in an adjacencies.csv to a map which was scaled by
+// integer factors, then verifies against the *scaled* province map that each start point still lies on the
+// adjacency's "from" province and each stop point on its "to" province. Points which do not are snapped to the
+// nearest pixel of the correct province within a search radius (proportional to the scale factor).
+//
+// All of the point queries go to the in-memory SegmentMap, so the whole file is handled in one bulk pass without
+// ever going back to the bitmap.
+//
+// NOTE: Adjacency coordinates use the game's coordinate system, in which y=0 is the *bottom* row of the map,
+// whereas SegmentMap rows are indexed from the top.
+
+struct AdjacencyScaler
+{
+  AdjacencyScaler(const ProvSegmentMap& scaled_map, uint scale_x, uint scale_y);
+
+  // Rescales all adjacencies in-place.
+  void scale(AdjacenciesFile&);
+
+  // Serializes the adjacencies back into the CSV format that the game expects (including the terminating dummy
+  // row which the game's parser requires).
+  static void write(const AdjacenciesFile&, const fs::path&);
+
+  auto n_points()     const noexcept { return _M_n_points; }
+  auto n_snapped()    const noexcept { return _M_n_snapped; }
+  auto n_unresolved() const noexcept { return _M_n_unresolved; }
+
+  void print_summary(FILE* f = stderr) const;
+
+private:
+  // Transform a single game-coordinate point and make sure that it lands upon the province `id`. Returns false
+  // if no pixel of `id` could be found within the snap radius (point is then left at its transformed location).
+  bool scale_point(int& x, int& y, prov_id_t id);
+
+  // Finds the closest (Euclidean) pixel of province `id` to the map-space point (x, y) within the snap radius.
+  bool find_nearest(prov_id_t id, uint& x, uint& y) const;
+
+  const ProvSegmentMap& _M_map;
+  uint                  _M_scale_x;
+  uint                  _M_scale_y;
+  uint                  _M_snap_radius;
+  uint                  _M_n_points;
+  uint                  _M_n_snapped;
+  uint                  _M_n_unresolved;
+};
+
+
+//NAMESPACE_CK2_END;
+#endif
@@ -0,0 +1,269 @@
+#include "AllocStats.h"
+
+#ifdef MAPSCALER_ALLOC_STATS
+
+#include <atomic>
+#include <cstdlib>
+#include <mutex>
+#include <new>
+
+
+namespace {
+
+// Every block carries a header right before the pointer we hand out, recording the size requested (so frees can
+// be subtracted from the live count without relying on sized delete) and the distance back to what malloc()
+// returned (so over-aligned blocks can be freed).
+struct Header
+{
+  size_t size;
+  size_t offset;
+};
+
+
+// Each thread counts into its own counters, which are only ever written by that thread (so bumping them costs no
+// bus locking) and are summed up on demand. Counters are linked into a registry while their thread lives and
+// folded into g_retired when it exits.
+struct Counters
+{
+  std::atomic<uint64_t> n_allocs {0};
+  std::atomic<uint64_t> n_frees  {0};
+  std::atomic<uint64_t> n_bytes  {0};
+};
+
+inline void bump(std::atomic<uint64_t>& c, uint64_t n) noexcept
+{
+  c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+
+// Everything global is constant-initialized, so allocations during static initialization are counted correctly.
+std::mutex            g_registry_mutex;
+Counters              g_retired;
+std::atomic<uint64_t> g_live(0);
+std::atomic<uint64_t> g_peak(0);
+
+struct ThreadCounters;
+ThreadCounters*       g_registry = nullptr;
+
+// Set once a thread's counters have been destroyed, after which any allocations that thread still makes (from
+// other thread_local destructors) are counted straight into g_retired
+thread_local bool     t_exited = false;
+
+
+struct ThreadCounters : Counters
+{
+  ThreadCounters() noexcept
+  {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    next = g_registry;
+    if (next) next->prev = this;
+    g_registry = this;
+  }
+
+  ~ThreadCounters()
+  {
+    std::lock_guard<std::mutex> lock(g_registry_mutex);
+    g_retired.n_allocs.fetch_add(n_allocs.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    g_retired.n_frees.fetch_add(n_frees.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    g_retired.n_bytes.fetch_add(n_bytes.load(std::memory_order_relaxed), std::memory_order_relaxed);
+
+    if (prev) prev->next = next; else g_registry = next;
+    if (next) next->prev = prev;
+
+    t_exited = true;
+  }
+
+  ThreadCounters* prev = nullptr;
+  ThreadCounters* next = nullptr;
+};
+
+thread_local ThreadCounters t_counters;
+
+
+void raise_peak(std::atomic<uint64_t>& peak, uint64_t n) noexcept
+{
+  uint64_t p = peak.load(std::memory_order_relaxed);
+  while (p < n && !peak.compare_exchange_weak(p, n, std::memory_order_relaxed)) {}
+}
+
+
+void count_alloc(size_t sz) noexcept
+{
+  if (t_exited)
+  {
+    g_retired.n_allocs.fetch_add(1, std::memory_order_relaxed);
+    g_retired.n_bytes.fetch_add(sz, std::memory_order_relaxed);
+  }
+  else
+  {
+    bump(t_counters.n_allocs, 1);
+    bump(t_counters.n_bytes, sz);
+  }
+
+  raise_peak(g_peak, g_live.fetch_add(sz, std::memory_order_relaxed) + sz);
+}
+
+
+void count_free(size_t sz) noexcept
+{
+  if (t_exited)
+    g_retired.n_frees.fetch_add(1, std::memory_order_relaxed);
+  else
+    bump(t_counters.n_frees, 1);
+
+  g_live.fetch_sub(sz, std::memory_order_relaxed);
+}
+
+
+void* try_alloc(size_t sz, size_t align) noexcept
+{
+  if (align < alignof(std::max_align_t))
+    align = alignof(std::max_align_t);
+
+  if (sz > SIZE_MAX - sizeof(Header) - align)
+    return nullptr;
+
+  auto p_raw = static_cast<char*>( std::malloc(sz + sizeof(Header) + align - 1) );
+
+  if (!p_raw)
+    return nullptr;
+
+  const auto raw_addr = reinterpret_cast<uintptr_t>(p_raw);
+  const auto addr     = (raw_addr + sizeof(Header) + align - 1) & ~uintptr_t(align - 1);
+  const auto p        = p_raw + (addr - raw_addr);
+
+  auto p_hdr = reinterpret_cast<Header*>(p) - 1;
+  p_hdr->size   = sz;
+  p_hdr->offset = static_cast<size_t>(p - p_raw);
+
+  count_alloc(sz);
+  return p;
+}
+
+
+void* alloc(size_t sz, size_t align)
+{
+  if (sz == 0)
+    sz = 1;
+
+  for (;;)
+  {
+    if (auto p = try_alloc(sz, align))
+      return p;
+
+    if (auto handler = std::get_new_handler())
+      handler();
+    else
+      throw std::bad_alloc();
+  }
+}
+
+
+void* alloc_nothrow(size_t sz, size_t align) noexcept
+{
+  try {
+    return alloc(sz, align);
+  }
+  catch (...) {
+    return nullptr;
+  }
+}
+
+
+void dealloc(void* p) noexcept
+{
+  if (!p)
+    return;
+
+  auto p_hdr = static_cast<Header*>(p) - 1;
+  count_free(p_hdr->size);
+  std::free(static_cast<char*>(p) - p_hdr->offset);
+}
+
+}
+
+
+// Replacements for every replaceable global allocation function (the sized & nothrow deletes must be replaced
+// too, since their defaults aren't guaranteed to forward to ours)
+
+void* operator new  (size_t sz)                                            { return alloc(sz, 0); }
+void* operator new[](size_t sz)                                            { return alloc(sz, 0); }
+void* operator new  (size_t sz, std::align_val_t al)                       { return alloc(sz, size_t(al)); }
+void* operator new[](size_t sz, std::align_val_t al)                       { return alloc(sz, size_t(al)); }
+void* operator new  (size_t sz, const std::nothrow_t&) noexcept            { return alloc_nothrow(sz, 0); }
+void* operator new[](size_t sz, const std::nothrow_t&) noexcept            { return alloc_nothrow(sz, 0); }
+void* operator new  (size_t sz, std::align_val_t al, const std::nothrow_t&) noexcept
+{ return alloc_nothrow(sz, size_t(al)); }
+void* operator new[](size_t sz, std::align_val_t al, const std::nothrow_t&) noexcept
+{ return alloc_nothrow(sz, size_t(al)); }
+
+void operator delete  (void* p) noexcept                                    { dealloc(p); }
+void operator delete[](void* p) noexcept                                    { dealloc(p); }
+void operator delete  (void* p, size_t) noexcept                            { dealloc(p); }
+void operator delete[](void* p, size_t) noexcept                            { dealloc(p); }
+void operator delete  (void* p, std::align_val_t) noexcept                  { dealloc(p); }
+void operator delete[](void* p, std::align_val_t) noexcept                  { dealloc(p); }
+void operator delete  (void* p, size_t, std::align_val_t) noexcept          { dealloc(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept          { dealloc(p); }
+void operator delete  (void* p, const std::nothrow_t&) noexcept             { dealloc(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept             { dealloc(p); }
+void operator delete  (void* p, std::align_val_t, const std::nothrow_t&) noexcept { dealloc(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { dealloc(p); }
+
+
+AllocStats alloc_stats() noexcept
+{
+  AllocStats s;
+  std::lock_guard<std::mutex> lock(g_registry_mutex);
+
+  auto add = [&](const Counters& c) {
+    s.n_allocs += c.n_allocs.load(std::memory_order_relaxed);
+    s.n_frees  += c.n_frees.load(std::memory_order_relaxed);
+    s.n_bytes  += c.n_bytes.load(std::memory_order_relaxed);
+  };
+
+  add(g_retired);
+
+  for (auto p_c = g_registry; p_c; p_c = p_c->next)
+    add(*p_c);
+
+  s.live_bytes = g_live.load(std::memory_order_relaxed);
+  s.peak_bytes = g_peak.load(std::memory_order_relaxed);
+  return s;
+}
+
+
+AllocScope::AllocScope() noexcept
+: _M_start( alloc_stats() )
+  // The scope's high-water mark starts at the current live count; the enclosing scope's is put back on exit.
+, _M_outer_peak( g_peak.exchange(_M_start.live_bytes, std::memory_order_relaxed) ) {}
+
+
+AllocScope::~AllocScope() noexcept
+{
+  raise_peak(g_peak, _M_outer_peak);
+}
+
+
+AllocStats AllocScope::stats() const noexcept
+{
+  auto s = alloc_stats();
+  s.n_allocs -= _M_start.n_allocs;
+  s.n_frees  -= _M_start.n_frees;
+  s.n_bytes  -= _M_start.n_bytes;
+  return s;
+}
+
+
+#else
+
+
+AllocStats alloc_stats() noexcept { return {}; }
+
+AllocScope::AllocScope() noexcept : _M_outer_peak(0) {}
+AllocScope::~AllocScope() noexcept {}
+
+AllocStats AllocScope::stats() const noexcept { return {}; }
+
+
+#endif
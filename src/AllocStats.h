@@ -0,0 +1,57 @@
+#ifndef MAPSCALER_ALLOC_STATS_H
+#define MAPSCALER_ALLOC_STATS_H
+
+#include <cstdint>
+
+#include "common.h"
+
+
+// Heap instrumentation. In builds with ALLOC_STATS=1 (which defines MAPSCALER_ALLOC_STATS), the global operator
+// new & delete are replaced by versions which count allocations, frees & bytes in per-thread counters and track
+// the process-wide number of live bytes and its high-water mark. Otherwise, nothing is replaced and everything
+// here reports zeros, at no cost.
+//
+// Only memory allocated through operator new is seen (which includes every std container and all of our Arenas'
+// chunks, but not, e.g., stdio's buffers).
+
+#ifdef MAPSCALER_ALLOC_STATS
+constexpr bool ALLOC_STATS_ENABLED = true;
+#else
+constexpr bool ALLOC_STATS_ENABLED = false;
+#endif
+
+
+struct AllocStats
+{
+  uint64_t n_allocs   = 0;
+  uint64_t n_frees    = 0;
+  uint64_t n_bytes    = 0; // total bytes requested
+  uint64_t live_bytes = 0;
+  uint64_t peak_bytes = 0; // high-water mark of live_bytes
+};
+
+
+// Totals over all threads (including those which have exited) since startup
+AllocStats alloc_stats() noexcept;
+
+
+// Measures the heap activity of all threads over its lifetime: counts are deltas since construction, and
+// peak_bytes is the high-water mark of live bytes reached since construction. Scopes may be nested, but they are
+// meant to follow the program's stage structure on one thread (as ScopeTracer does), not to overlap arbitrarily.
+struct AllocScope
+{
+  AllocScope() noexcept;
+  ~AllocScope() noexcept;
+
+  AllocScope(const AllocScope&) = delete;
+  AllocScope& operator=(const AllocScope&) = delete;
+
+  AllocStats stats() const noexcept;
+
+private:
+  AllocStats _M_start;
+  uint64_t   _M_outer_peak; // the enclosing scope's high-water mark, to be restored upon exit
+};
+
+
+#endif
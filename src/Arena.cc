@@ -0,0 +1,96 @@
+#include "Arena.h"
+
+#include <algorithm>
+
+
+namespace {
+
+// Every arena generation (i.e., every construction or release()) gets a new epoch, so a thread's cached shard
+// pointer can never be mistaken for one belonging to a later arena at the same address.
+std::atomic<uint64_t> g_next_epoch(1);
+
+// Each thread remembers its shards of the last few arenas it allocated from, which covers the usual case of a
+// stage allocating from its input's and its output's arenas alternately. Missing the cache only costs a lookup
+// under the arena's lock; the thread still gets its existing shard back.
+constexpr uint SHARD_CACHE_SIZE = 4;
+
+struct ShardCacheEntry
+{
+  uint64_t epoch   = 0;
+  void*    p_shard = nullptr;
+};
+
+thread_local ShardCacheEntry t_shard_cache[SHARD_CACHE_SIZE];
+thread_local uint            t_shard_cache_next = 0;
+
+}
+
+
+Arena::Arena(size_t initial_chunk_size, std::pmr::memory_resource* upstream)
+: _M_chunk_sz( std::max<size_t>(initial_chunk_size, 64) )
+, _M_upstream(upstream)
+, _M_epoch( g_next_epoch.fetch_add(1, std::memory_order_relaxed) ) {}
+
+
+Arena::~Arena() = default;
+
+
+void Arena::release() noexcept
+{
+  std::lock_guard<std::mutex> lock(_M_mutex);
+  _M_shards.clear();
+  _M_epoch = g_next_epoch.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+size_t Arena::bytes_allocated() const noexcept
+{
+  std::lock_guard<std::mutex> lock(_M_mutex);
+  size_t n = 0;
+
+  for (const auto& p_shard : _M_shards)
+    n += p_shard->n_bytes.load(std::memory_order_relaxed);
+
+  return n;
+}
+
+
+uint Arena::n_shards() const noexcept
+{
+  std::lock_guard<std::mutex> lock(_M_mutex);
+  return static_cast<uint>(_M_shards.size());
+}
+
+
+void* Arena::do_allocate(size_t n_bytes, size_t alignment)
+{
+  auto& shard = local_shard();
+  shard.n_bytes.store(shard.n_bytes.load(std::memory_order_relaxed) + n_bytes, std::memory_order_relaxed);
+  return shard.buffer.allocate(n_bytes, alignment);
+}
+
+
+Arena::Shard& Arena::local_shard()
+{
+  // (_M_epoch only changes in release(), which mustn't race with allocation)
+  for (const auto& e : t_shard_cache)
+    if (e.epoch == _M_epoch)
+      return *static_cast<Shard*>(e.p_shard);
+
+  std::lock_guard<std::mutex> lock(_M_mutex);
+  const auto this_thread = std::this_thread::get_id();
+
+  auto it = std::find_if(_M_shards.begin(), _M_shards.end(),
+                         [&](const auto& p_shard) { return p_shard->owner == this_thread; });
+
+  if (it == _M_shards.end())
+  {
+    _M_shards.push_back( std::make_unique<Shard>(_M_chunk_sz, _M_upstream) );
+    _M_shards.back()->owner = this_thread;
+    it = _M_shards.end() - 1;
+  }
+
+  t_shard_cache[t_shard_cache_next] = { _M_epoch, it->get() };
+  t_shard_cache_next = (t_shard_cache_next + 1) % SHARD_CACHE_SIZE;
+  return **it;
+}
@@ -0,0 +1,69 @@
+#ifndef MAPSCALER_ARENA_H
+#define MAPSCALER_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+
+
+// Monotonic memory arena for the lifetime of one pipeline stage (or one band of one). Everything allocated from it
+// is freed at once by release() or destruction, and individual deallocations are no-ops, so building a
+// SegmentMap costs a pointer bump per row instead of a trip through the global allocator.
+//
+// Unlike a bare std::pmr::monotonic_buffer_resource, an Arena may be allocated from by any number of threads at
+// once: each thread gets its own shard (a monotonic buffer of its own), so parallel row builders never contend
+// for a lock, nor for the global heap.
+
+struct Arena : std::pmr::memory_resource
+{
+  // Shards start with chunks of `initial_chunk_size` bytes and grow geometrically from there.
+  explicit Arena(size_t initial_chunk_size = 1 << 20,
+                 std::pmr::memory_resource* upstream = std::pmr::new_delete_resource());
+  ~Arena() override;
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  // Free everything allocated from the arena. Nothing allocated from it may be used afterward, and no thread may
+  // be allocating from it concurrently.
+  void release() noexcept;
+
+  // Bytes handed out since construction or the last release() (not counting the shards' slack)
+  size_t bytes_allocated() const noexcept;
+
+  uint n_shards() const noexcept;
+
+protected:
+  void* do_allocate(size_t n_bytes, size_t alignment) override;
+  void  do_deallocate(void*, size_t, size_t) override {}
+  bool  do_is_equal(const std::pmr::memory_resource& o) const noexcept override { return this == &o; }
+
+private:
+  struct Shard
+  {
+    Shard(size_t initial_chunk_size, std::pmr::memory_resource* upstream)
+    : buffer(initial_chunk_size, upstream), n_bytes(0) {}
+
+    std::pmr::monotonic_buffer_resource buffer;
+    std::atomic<size_t>                 n_bytes; // only ever written by the owning thread
+    std::thread::id                     owner;
+  };
+
+  Shard& local_shard();
+
+  size_t                              _M_chunk_sz;
+  std::pmr::memory_resource*          _M_upstream;
+  uint64_t                            _M_epoch; // unique to this arena & generation (see local_shard())
+  mutable std::mutex                  _M_mutex;
+  std::vector< std::unique_ptr<Shard> > _M_shards;
+};
+
+
+#endif
@@ -0,0 +1,416 @@
+#include "AsyncReader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <ck2/FileLocation.h>
+
+#if !defined(_WIN32)
+#  include <fcntl.h>
+#  include <unistd.h>
+#endif
+
+#ifdef MAPSCALER_HAVE_LIBURING
+#  include <liburing.h>
+#endif
+
+
+using namespace ck2;
+
+
+namespace {
+
+constexpr uint MAX_POOL_THREADS = 4;
+
+struct Slot
+{
+  std::unique_ptr<uint8_t[]> buf;
+  uint64_t block  = 0; // index of the block this slot is reading or holds
+  size_t   len    = 0; // bytes requested
+  size_t   n_read = 0; // bytes read so far
+  int      error  = 0; // errno, if the read failed
+  bool     ready  = false;
+};
+
+}
+
+
+/* common part of the backends: the ring of block slots and the consumer side of it */
+
+struct AsyncReader::Impl
+{
+  Impl(const fs::path& path, uint64_t offset, uint64_t length, size_t block_sz, uint depth, bool backward)
+  : _path(path)
+  , _offset(offset)
+  , _length(length)
+  , _block_sz(block_sz)
+  , _n_blocks((length + block_sz - 1) / block_sz)
+  , _next_block(0)
+  , _backward(backward)
+  , _slots( std::max(1u, depth) )
+  {
+    for (auto& s : _slots)
+      s.buf = std::make_unique<uint8_t[]>(block_sz);
+  }
+
+  virtual ~Impl() = default;
+
+  virtual const char* name() const noexcept = 0;
+  virtual void submit(Slot&) = 0; // start reading s.block into s
+  virtual void wait(Slot&) = 0;   // wait until s.ready
+
+  // to be called at the end of the derived constructor
+  void start()
+  {
+    for (uint64_t b = 0; b < std::min<uint64_t>(_n_blocks, _slots.size()); ++b)
+      enqueue(b);
+  }
+
+  const uint8_t* next(size_t& size)
+  {
+    // The slot holding the block handed out by the previous call is free again, so refill it.
+    if (_next_block > 0 && _next_block - 1 + _slots.size() < _n_blocks)
+      enqueue(_next_block - 1 + _slots.size());
+
+    if (_next_block == _n_blocks)
+      return nullptr;
+
+    auto& s = _slots[_next_block % _slots.size()];
+    wait(s);
+
+    if (s.error)
+      throw FLError(FLoc(_path), "Failed to read {} bytes at byte offset {}: {}",
+                    s.len, block_offset(s.block), strerror(s.error));
+
+    ++_next_block;
+    size = s.n_read;
+    return s.buf.get();
+  }
+
+protected:
+  size_t block_len(uint64_t block) const noexcept
+  {
+    return static_cast<size_t>( std::min<uint64_t>(_block_sz, _length - block * _block_sz) );
+  }
+
+  uint64_t block_offset(uint64_t block) const noexcept
+  {
+    return (_backward) ? _offset + _length - block * _block_sz - block_len(block)
+                       : _offset + block * _block_sz;
+  }
+
+  void enqueue(uint64_t block)
+  {
+    auto& s = _slots[block % _slots.size()];
+    s.block = block;
+    s.len = block_len(block);
+    s.n_read = 0;
+    s.error = 0;
+    s.ready = false;
+    submit(s);
+  }
+
+  fs::path          _path;
+  uint64_t          _offset;
+  uint64_t          _length;
+  size_t            _block_sz;
+  uint64_t          _n_blocks;
+  uint64_t          _next_block;
+  bool              _backward;
+  std::vector<Slot> _slots;
+};
+
+
+namespace {
+
+/* fallback backend: a few threads doing plain positional reads */
+
+struct PoolImpl : AsyncReader::Impl
+{
+  PoolImpl(const fs::path& path, uint64_t offset, uint64_t length, size_t block_sz, uint depth, bool backward)
+  : Impl(path, offset, length, block_sz, depth, backward)
+  , _stop(false)
+  {
+#if !defined(_WIN32)
+    if ( (_fd = ::open(path.string().c_str(), O_RDONLY)) < 0 )
+      throw FLError(FLoc(path), "Failed to open file: {}", strerror(errno));
+
+#  ifdef POSIX_FADV_SEQUENTIAL
+    if (!backward) // the kernel's readahead only helps going forward; otherwise, we're on our own
+      posix_fadvise(_fd, static_cast<off_t>(offset), static_cast<off_t>(length), POSIX_FADV_SEQUENTIAL);
+#  endif
+#endif
+
+    const uint n_threads = std::min<uint>(static_cast<uint>(_slots.size()), MAX_POOL_THREADS);
+
+    // (the destructor won't run if we throw, and the workers which did start must be joined)
+    try
+    {
+      for (uint i = 0; i < n_threads; ++i)
+        _threads.emplace_back([this] { work(); });
+
+      start();
+    }
+    catch (...)
+    {
+      shut_down();
+      throw;
+    }
+  }
+
+  ~PoolImpl() override { shut_down(); }
+
+  const char* name() const noexcept override { return "read-ahead thread pool"; }
+
+  void submit(Slot& s) override
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _queue.push_back(&s);
+    }
+
+    _work_cv.notify_one();
+  }
+
+  void wait(Slot& s) override
+  {
+    std::unique_lock<std::mutex> lock(_mutex);
+    _done_cv.wait(lock, [&] { return s.ready; });
+  }
+
+private:
+  void shut_down()
+  {
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _stop = true;
+    }
+
+    _work_cv.notify_all();
+
+    for (auto& t : _threads)
+      t.join();
+
+#if !defined(_WIN32)
+    ::close(_fd);
+#endif
+  }
+
+  void work()
+  {
+#if defined(_WIN32)
+    // no pread() here, so every worker has its own stream to seek around in
+    unique_fptr ufp( std::fopen(_path.string().c_str(), "rb"), std::fclose );
+#endif
+
+    for (;;)
+    {
+      Slot* s;
+
+      {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _work_cv.wait(lock, [&] { return _stop || !_queue.empty(); });
+
+        if (_stop)
+          return;
+
+        s = _queue.front();
+        _queue.pop_front();
+      }
+
+      // Nobody else touches the slot until it's marked ready.
+      const uint64_t pos = block_offset(s->block);
+
+#if defined(_WIN32)
+      if (!ufp || _fseeki64(ufp.get(), static_cast<long long>(pos), SEEK_SET) != 0)
+        s->error = errno ? errno : EIO;
+      else if (errno = 0; (s->n_read = fread(s->buf.get(), 1, s->len, ufp.get())) < s->len && ferror(ufp.get()))
+        s->error = errno ? errno : EIO;
+#else
+      while (s->n_read < s->len)
+      {
+        auto r = ::pread(_fd, s->buf.get() + s->n_read, s->len - s->n_read, static_cast<off_t>(pos + s->n_read));
+
+        if (r < 0 && errno == EINTR)
+          continue;
+
+        if (r < 0)
+          s->error = errno;
+
+        if (r <= 0)
+          break;
+
+        s->n_read += static_cast<size_t>(r);
+      }
+#endif
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        s->ready = true;
+      }
+
+      _done_cv.notify_all();
+    }
+  }
+
+#if !defined(_WIN32)
+  int                      _fd;
+#endif
+  bool                     _stop;
+  std::mutex               _mutex;
+  std::condition_variable  _work_cv;
+  std::condition_variable  _done_cv;
+  std::deque<Slot*>        _queue;
+  std::vector<std::thread> _threads;
+};
+
+
+#ifdef MAPSCALER_HAVE_LIBURING
+
+/* io_uring backend: all reads are submitted from & completed on the consuming thread */
+
+struct UringImpl : AsyncReader::Impl
+{
+  // nullptr if the kernel won't give us a ring (too old, or disabled, as in many containers)
+  static std::unique_ptr<Impl> create(const fs::path& path, uint64_t offset, uint64_t length, size_t block_sz,
+                                      uint depth, bool backward)
+  {
+    std::unique_ptr<UringImpl> p( new UringImpl(path, offset, length, block_sz, depth, backward) );
+
+    if (io_uring_queue_init(static_cast<unsigned>(p->_slots.size()), &p->_ring, 0) < 0)
+      return nullptr;
+
+    p->_ring_ok = true;
+    p->start();
+    return p;
+  }
+
+  ~UringImpl() override
+  {
+    // the kernel may still be writing into our buffers
+    while (_ring_ok && _n_in_flight > 0)
+    {
+      io_uring_cqe* cqe;
+
+      if (int ret = io_uring_wait_cqe(&_ring, &cqe); ret == -EINTR)
+        continue;
+      else if (ret < 0)
+        break;
+
+      io_uring_cqe_seen(&_ring, cqe);
+      --_n_in_flight;
+    }
+
+    if (_ring_ok)
+      io_uring_queue_exit(&_ring);
+
+    ::close(_fd);
+  }
+
+  const char* name() const noexcept override { return "io_uring"; }
+
+  void submit(Slot& s) override
+  {
+    auto sqe = io_uring_get_sqe(&_ring); // never NULL: the ring has an entry for every slot
+    io_uring_prep_read(sqe, _fd, s.buf.get() + s.n_read, static_cast<unsigned>(s.len - s.n_read),
+                       block_offset(s.block) + s.n_read);
+    io_uring_sqe_set_data(sqe, &s);
+
+    if (int ret = io_uring_submit(&_ring); ret < 0)
+    {
+      s.error = -ret;
+      s.ready = true;
+      return;
+    }
+
+    ++_n_in_flight;
+  }
+
+  void wait(Slot& s) override
+  {
+    while (!s.ready)
+    {
+      io_uring_cqe* cqe;
+
+      if (int ret = io_uring_wait_cqe(&_ring, &cqe); ret == -EINTR)
+        continue;
+      else if (ret < 0)
+      {
+        s.error = -ret;
+        s.ready = true;
+        break;
+      }
+
+      auto& done = *static_cast<Slot*>( io_uring_cqe_get_data(cqe) );
+      const int res = cqe->res;
+      io_uring_cqe_seen(&_ring, cqe);
+      --_n_in_flight;
+
+      if (res == -EINTR || res == -EAGAIN)
+        submit(done);
+      else if (res < 0)
+      {
+        done.error = -res;
+        done.ready = true;
+      }
+      else
+      {
+        done.n_read += static_cast<size_t>(res);
+
+        if (res == 0 || done.n_read == done.len) // complete, or EOF
+          done.ready = true;
+        else
+          submit(done); // short read; go for the rest
+      }
+    }
+  }
+
+private:
+  UringImpl(const fs::path& path, uint64_t offset, uint64_t length, size_t block_sz, uint depth, bool backward)
+  : Impl(path, offset, length, block_sz, depth, backward)
+  , _ring_ok(false)
+  , _n_in_flight(0)
+  {
+    if ( (_fd = ::open(path.string().c_str(), O_RDONLY)) < 0 )
+      throw FLError(FLoc(path), "Failed to open file: {}", strerror(errno));
+  }
+
+  int      _fd;
+  bool     _ring_ok;
+  uint     _n_in_flight;
+  io_uring _ring;
+};
+
+#endif // MAPSCALER_HAVE_LIBURING
+
+}
+
+
+AsyncReader::AsyncReader(const fs::path& path, uint64_t offset, uint64_t length, size_t block_size, uint depth,
+                         bool backward)
+: _M_path(path)
+, _M_block_sz(block_size)
+{
+  assert(block_size > 0);
+
+#ifdef MAPSCALER_HAVE_LIBURING
+  _M_impl = UringImpl::create(path, offset, length, block_size, depth, backward);
+#endif
+
+  if (!_M_impl)
+    _M_impl = std::make_unique<PoolImpl>(path, offset, length, block_size, depth, backward);
+}
+
+
+AsyncReader::~AsyncReader() = default;
+
+
+const uint8_t* AsyncReader::next(size_t& size) { return _M_impl->next(size); }
+const char* AsyncReader::backend_name() const noexcept { return _M_impl->name(); }
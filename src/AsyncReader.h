@@ -0,0 +1,49 @@
+#ifndef MAPSCALER_ASYNC_READER_H
+#define MAPSCALER_ASYNC_READER_H
+
+#include <cstdint>
+#include <memory>
+
+#include "common.h"
+#include "filesystem.h"
+
+
+// Sequential read-ahead over a byte range of a file, delivered as a series of fixed-size blocks. Up to `depth`
+// blocks are in flight at once, so while the consumer works on one block, the following ones are already being
+// read; with cold caches, this keeps the device queue busy instead of serializing small synchronous reads with
+// processing.
+//
+// Blocks may also be delivered backward, from the end of the range to its start (for reading files whose records
+// are stored in the reverse of the order in which they're wanted). The range is then split into blocks starting
+// from its end, so only the last block delivered is short.
+//
+// Where available (Linux, built with IO_URING=1), reads are submitted through io_uring. Otherwise, or if the
+// kernel refuses to set up a ring, a small pool of threads issues plain positional reads.
+
+struct AsyncReader
+{
+  AsyncReader(const fs::path&, uint64_t offset, uint64_t length, size_t block_size, uint depth = 4,
+              bool backward = false);
+  ~AsyncReader();
+
+  AsyncReader(const AsyncReader&) = delete;
+  AsyncReader& operator=(const AsyncReader&) = delete;
+
+  // Returns the next block and sets `size` to its length (block_size, except for a short final block or EOF), or
+  // returns nullptr once the range is exhausted. The block remains valid until the following call.
+  const uint8_t* next(size_t& size);
+
+  auto& path()       const noexcept { return _M_path; }
+  auto  block_size() const noexcept { return _M_block_sz; }
+  const char* backend_name() const noexcept;
+
+  struct Impl; // backend; defined in AsyncReader.cc
+
+private:
+  fs::path              _M_path;
+  size_t                _M_block_sz;
+  std::unique_ptr<Impl> _M_impl;
+};
+
+
+#endif
@@ -3,12 +3,14 @@
 #include <cerrno>
 #include <cstdio>
 #include <cstdlib>
+#include <limits>
 #include <string>
 #include <unordered_map>
 
 #include <ck2/Color.h>
 #include <ck2/FileLocation.h>
 #include "filesystem.h"
+#include "kernels.h"
 
 
 //NAMESPACE_CK2;
@@ -19,6 +21,8 @@ BMPReader::BMPReader(const fs::path& path)
 : _M_width(0)
 , _M_height(0)
 , _M_row_sz(0)
+, _M_top_down(false)
+, _M_emit_top_down(false)
 , _M_path(path)
 , _M_file( std::fopen(path.string().c_str(), "rb"), std::fclose )
 {
@@ -45,41 +49,134 @@ BMPReader::BMPReader(const fs::path& path)
   if (_M_hdr.n_width <= 0)
     throw ferr("Format unsupported: Expected positive image width, found {}", _M_hdr.n_width);
 
-  if (_M_hdr.n_height <= 0)
-    throw ferr("Format unsupported: Expected positive image height, found {}", _M_hdr.n_height);
+  // a negative height means that rows are stored top-to-bottom
+  if (_M_hdr.n_height == 0 || _M_hdr.n_height == std::numeric_limits<int32_t>::min())
+    throw ferr("Format unsupported: Invalid image height of {}", _M_hdr.n_height);
 
-  if (_M_hdr.n_width == 1 || _M_hdr.n_height == 1)
-    throw ferr("Image dimensions ({}x{}) insufficient to support a map", _M_hdr.n_width, _M_hdr.n_height);
+  _M_top_down = (_M_hdr.n_height < 0);
+  const auto abs_height = std::abs(_M_hdr.n_height);
+
+  if (_M_hdr.n_width == 1 || abs_height == 1)
+    throw ferr("Image dimensions ({}x{}) insufficient to support a map", _M_hdr.n_width, abs_height);
 
   if (_M_hdr.n_planes != 1)
     throw ferr("Format unsupported: Should only be 1 image plane, found {}", _M_hdr.n_planes);
 
-  // TODO: When moving to indexed color support, this check will be dependent upon our "essence" type (see 'Essence' Design Pattern).
-  if (_M_hdr.n_bpp != 24)
-    throw ferr("Format unsupported: Need 24bpp color but found {}", _M_hdr.n_bpp);
+  if (_M_hdr.n_bpp != 24 && _M_hdr.n_bpp != 8 && _M_hdr.n_bpp != 4)
+    throw ferr("Format unsupported: Need 24bpp color or 8bpp/4bpp indexed color but found {}bpp", _M_hdr.n_bpp);
 
-  if (_M_hdr.compression_type != 0)
+  switch (_M_hdr.compression_type)
+  {
+  case UNCOMPRESSED:
+    break;
+  case RLE8:
+    if (_M_hdr.n_bpp != 8)
+      throw ferr("File corruption: RLE8 compression requires 8bpp, but found {}bpp", _M_hdr.n_bpp);
+    break;
+  case RLE4:
+    if (_M_hdr.n_bpp != 4)
+      throw ferr("File corruption: RLE4 compression requires 4bpp, but found {}bpp", _M_hdr.n_bpp);
+    break;
+  default:
     throw ferr("Format unsupported: Found unsupported compression type #{}", _M_hdr.compression_type);
+  }
 
-  // TODO: When moving to indexed color support, this check will be dependent upon our "essence" type (see 'Essence' Design Pattern).
-  if (_M_hdr.n_colors != 0)
-    throw ferr("Format unsupported: Image shouldn't be paletted, but {} colors were specified",
+  if (is_rle() && _M_top_down)
+    throw ferr("File corruption: RLE-compressed bitmaps can't be top-down (negative height)");
+
+  if (_M_hdr.n_bpp == 24 && _M_hdr.n_colors != 0)
+    throw ferr("Format unsupported: 24bpp image shouldn't be paletted, but {} colors were specified",
                _M_hdr.n_colors);
 
-  assert( _M_hdr.n_important_colors == 0 );
+  if (is_indexed() && _M_hdr.n_colors > (1u << bpp()))
+    throw ferr("File corruption: {} palette colors specified, but {}bpp allows at most {}",
+               _M_hdr.n_colors, bpp(), 1u << bpp());
 
   _M_width = _M_hdr.n_width;
-  _M_height = _M_hdr.n_height;
+  _M_height = static_cast<uint>(abs_height);
 
   // calculate row size with 32-bit alignment padding and consequent raw bitmap size
   _M_row_sz = 4 * ((width() * bpp() + 31) / 32);
   auto bitmap_sz = _M_row_sz * _M_height;
 
-  if (_M_hdr.n_bitmap_size != 0 && _M_hdr.n_bitmap_size != bitmap_sz)
+  // (an RLE bitmap's size is whatever it compressed to)
+  if (!is_rle() && _M_hdr.n_bitmap_size != 0 && _M_hdr.n_bitmap_size != bitmap_sz)
     throw ferr("File corruption: Raw bitmap data section should be {} bytes but {} were specified",
                bitmap_sz, _M_hdr.n_bitmap_size);
 
-  // TODO: load image palette if it has one
+  if (is_indexed())
+  {
+    // the palette (as 4-byte BGRx entries) immediately follows the DIB header, which follows the 14-byte file header
+    std::vector<uint8_t> raw_palette(4 * color_count());
+
+    if (fseek(_M_file.get(), 14 + _M_hdr.n_header_size, SEEK_SET) != 0 ||
+        fread(raw_palette.data(), raw_palette.size(), 1, _M_file.get()) < 1)
+      throw ferr("Unexpected EOF while reading {}-color palette (file corruption)", color_count());
+
+    for (uint i = 0; i < color_count(); ++i)
+      _M_palette.emplace_back(&raw_palette[4 * i]);
+
+    // indices beyond the specified colors are undefined, so they're resolved to black rather than read out of
+    // bounds
+    _M_palette.resize(1u << bpp());
+  }
+}
+
+
+void BMPReader::set_row_order(RowOrder order) noexcept
+{
+  switch (order)
+  {
+  case RowOrder::bottom_up: _M_emit_top_down = false;       break;
+  case RowOrder::top_down:  _M_emit_top_down = true;        break;
+  case RowOrder::storage:   _M_emit_top_down = _M_top_down; break;
+  }
+}
+
+
+uint64_t BMPReader::band_offset(uint first_row, uint n_rows) const noexcept
+{
+  // the band's rows, as numbered in storage order
+  const uint first_stored = (reads_backward()) ? _M_height - first_row - n_rows : first_row;
+  return _M_hdr.n_bitmap_offset + static_cast<uint64_t>(first_stored) * _M_row_sz;
+}
+
+
+void BMPReader::throw_eof(uint first_row, uint n_rows, uint n_read) const
+{
+  // whichever way the block was read, what's missing is the end of it in file order
+  const auto first_stored = (band_offset(first_row, n_rows) - _M_hdr.n_bitmap_offset) / _M_row_sz;
+
+  throw FLError(FLoc(_M_path), "Unexpected EOF while reading [{}] scanline #{}",
+                (_M_top_down) ? "top-to-bottom" : "bottom-to-top", first_stored + n_read);
+}
+
+
+uint64_t BMPReader::rle_size() const
+{
+  // the bitmap size is mandatory for compressed bitmaps, but be lenient & take the rest of the file if it's 0
+  return (_M_hdr.n_bitmap_size != 0) ? _M_hdr.n_bitmap_size
+                                     : fs::file_size(_M_path) - _M_hdr.n_bitmap_offset;
+}
+
+
+void BMPReader::scan_row(const uint8_t* row, std::vector<RowSegment>& segs) const
+{
+  if (bpp() == 8)
+    return scan_indexed_row<8>(row, segs);
+  else if (bpp() == 4)
+    return scan_indexed_row<4>(row, segs);
+
+  segs.clear();
+
+  const auto run_end = kernels().run_end_bgr24;
+
+  for (uint x = 0; x < _M_width; )
+  {
+    const uint end_x = run_end(row, x, _M_width);
+    segs.push_back({ BGR(row + 3 * static_cast<size_t>(x)), end_x });
+    x = end_x;
+  }
 }
 
 
@@ -1,14 +1,19 @@
 #ifndef MAPSCALER_BMP_READER_H
 #define MAPSCALER_BMP_READER_H
 
+#include <algorithm>
 #include <cstdio>
 #include <memory>
+#include <vector>
 
 #include <ck2/BMPHeader.h>
 #include <ck2/Color.h>
 #include <ck2/FileLocation.h>
+#include "AsyncReader.h"
+#include "RLEDecoder.h"
 #include "common.h"
 #include "filesystem.h"
+#include "kernels.h"
 
 
 //NAMESPACE_CK2;
@@ -25,8 +30,13 @@ struct BMPReader
   auto  width()        const noexcept { return _M_width; }
   auto  height()       const noexcept { return _M_height; }
   auto  bpp()          const noexcept { return _M_hdr.n_bpp; }
+  auto  compression()  const noexcept { return _M_hdr.compression_type; }
   auto  file_size()    const noexcept { return _M_hdr.n_file_size; } // TODO: verify truth with stat() in init
   auto  color_count()  const noexcept { return (_M_hdr.n_colors == 0) ? (1 << bpp()) : _M_hdr.n_colors; }
+  auto  is_indexed()   const noexcept { return bpp() <= 8; }
+  auto  is_rle()       const noexcept { return compression() == RLE8 || compression() == RLE4; }
+  auto& palette()      const noexcept { return _M_palette; } // empty unless indexed
+  auto  is_top_down()  const noexcept { return _M_top_down; } // rows stored top-to-bottom (negative height)
 
   auto bitmap_size() const noexcept
   {
@@ -34,6 +44,11 @@ struct BMPReader
                                        : _M_hdr.n_bitmap_size;
   }
 
+  // BMP compression types (the ones we support, anyway)
+  static constexpr uint32_t UNCOMPRESSED = 0;
+  static constexpr uint32_t RLE8 = 1;
+  static constexpr uint32_t RLE4 = 2;
+
   // It's inevitable to need this, sadly:
   void dump_header(FILE* f = stderr) const { _M_hdr.print(f); }
 
@@ -44,12 +59,59 @@ struct BMPReader
   // start & end x-coordinates, and the common y-coordinate.
   //
   // NOTE: BMPs are 99.999% of the time stored in bottom-to-top row order (i.e., image is flipped vertically if
-  // you interpret the first row as the top row rather than the bottom row). Given this, we'll guarantee that
-  // 100% of the time, the row order emitted will be bottom-to-top (largest y-coords first). Row scan order is
-  // totally unaffected (left to right).
+  // you interpret the first row as the top row rather than the bottom row). Given this, unless set_row_order()
+  // says otherwise, the row order emitted will be bottom-to-top (largest y-coords first) even for the odd
+  // top-down file. Row scan order is totally unaffected (left to right).
   template<typename FuncT>
   void foreach_segment(const FuncT&);
 
+  // Same as above, but restricted to the `n_rows` rows starting at row `first_row` in emission order (i.e., by
+  // default, counting from the bottom of the image; see first_row_of()). A private file handle is opened for the
+  // duration of the call, so any number of such bands may be read concurrently from different threads.
+  template<typename FuncT>
+  void foreach_segment(const FuncT&, uint first_row, uint n_rows) const;
+
+  // Row-batched alternative to foreach_segment: all of a row's segments are collected into a reusable buffer of
+  // (color, end) pairs, and the callback is invoked just once per row as row_callback(span<const RowSegment>, y).
+  // A segment's start is the previous segment's end (or 0). Row order is the same as with foreach_segment.
+  //
+  // This keeps the per-segment work inside the reader's loop, where it can be inlined, and lets consumers resolve
+  // colors & append to their own rows in bulk.
+  struct RowSegment
+  {
+    BGR  color;
+    uint end;
+  };
+
+  template<typename FuncT>
+  void foreach_row_segments(const FuncT&);
+
+  template<typename FuncT>
+  void foreach_row_segments(const FuncT&, uint first_row, uint n_rows) const;
+
+  // All of the above read ahead asynchronously (see AsyncReader), so segmentation runs while the following data
+  // is still loading. Uncompressed bitmaps are read in blocks of whole rows. RLE8/RLE4 bitmaps are decoded
+  // straight into segments (see RLEDecoder); as their rows can't be located without decoding everything before
+  // them, reading a band of rows from one also decodes (but doesn't emit) all of the rows before the band.
+
+  // The order in which rows are emitted. When it's the reverse of the file's row order, the file is simply read
+  // backward, block by block, and each block's rows are walked last to first; nothing is copied or flipped. With
+  // `storage`, rows are emitted in whichever order the file stores them, which always reads sequentially.
+  // (RLE bitmaps are always stored bottom-up; emitting one top-down buffers each band's segments.)
+  enum class RowOrder { bottom_up, top_down, storage };
+
+  void set_row_order(RowOrder) noexcept;
+  auto emits_top_down() const noexcept { return _M_emit_top_down; }
+
+  // Emission-order row at which the band of y-coordinates [y_begin, y_end) starts
+  uint first_row_of(uint y_begin, uint y_end) const noexcept
+  {
+    return (_M_emit_top_down) ? y_begin : _M_height - y_end;
+  }
+
+  // y-coordinate of the row emitted `row` rows in
+  uint y_of(uint row) const noexcept { return (_M_emit_top_down) ? row : _M_height - 1 - row; }
+
   // TODO: add the raw row reading code (which one would use with continuous-tone images) to a separate class C,
   // wherein BMPReader is *currently* but would become B such that B & C derive from a superclass A which can
   // still handle most of the repetitive error-checking code and such whilst it will be impossible to intermix
@@ -59,61 +121,199 @@ struct BMPReader
   // void foreach_row(FuncT&);
 
 private:
+  friend struct RowSegmentStream; // pull-style reading shares our row decoding (see RowSegmentStream.h)
+
+  static constexpr uint READ_BLOCK_SIZE = 4 << 20; // bytes (rounded down to whole rows) per read
+  static constexpr uint READ_DEPTH = 4;             // blocks in flight
+
+  // Whether emission order is the reverse of storage order
+  bool reads_backward() const noexcept { return _M_emit_top_down != _M_top_down; }
+
+  // File offset of the raw rows emitted as rows [first_row, first_row + n_rows) (uncompressed bitmaps only)
+  uint64_t band_offset(uint first_row, uint n_rows) const noexcept;
+
+  uint rows_per_block() const noexcept { return std::max(1u, READ_BLOCK_SIZE / _M_row_sz); }
+
+  // For when a block which should have held the `n_rows` rows starting at `first_row` held only `n_read`
+  [[noreturn]] void throw_eof(uint first_row, uint n_rows, uint n_read) const;
+
+  // Calls row_func(row_data, y) for each of the rows (uncompressed bitmaps only)
+  template<typename FuncT>
+  void read_rows(uint first_row, uint n_rows, const FuncT&) const;
+
+  // Segment one row of uncompressed pixel data (of any of the supported bit depths)
+  void scan_row(const uint8_t* row, std::vector<RowSegment>&) const;
+
+  // Palette-indexed rows: segments are found by comparing indices, which are only then resolved to colors
+  template<uint BPP>
+  void scan_indexed_row(const uint8_t* row, std::vector<RowSegment>&) const;
+
+  // Size of the RLE-compressed bitmap data
+  uint64_t rle_size() const;
+
   uint        _M_width; // BMPHeader's dimensions are in packed struct; we need this well-aligned (and unsigned)
   uint        _M_height; // ^--
   uint        _M_row_sz; // Actual, calculated BMP raw row size with appropriate zero-padding for alignment.
+  bool        _M_top_down;
+  bool        _M_emit_top_down;
   BMPHeader   _M_hdr;
   fs::path    _M_path;
   unique_fptr _M_file;
+  std::vector<BGR> _M_palette;
 };
 
 
 template<typename FuncT>
 void BMPReader::foreach_segment(const FuncT& segment_callback)
 {
-  /* seek directly to file offset of pixel array. */
-  if (fseek(_M_file.get(), _M_hdr.n_bitmap_offset, SEEK_SET) != 0)
-    throw FLError(FLoc(_M_path),
-                  "Failed to seek to raw bitmap data section (byte offset: 0x{0:08X} / {0}): {1}",
-                  _M_hdr.n_bitmap_offset, strerror(errno));
+  static_cast<const BMPReader*>(this)->foreach_segment(segment_callback, 0, _M_height);
+}
+
+
+template<typename FuncT>
+void BMPReader::foreach_segment(const FuncT& segment_callback, uint first_row, uint n_rows) const
+{
+  foreach_row_segments(
+    [&](span<const RowSegment> segs, uint y)
+    {
+      uint start_x = 0;
+
+      for (const auto& seg : segs)
+      {
+        segment_callback(seg.color, start_x, seg.end, y);
+        start_x = seg.end;
+      }
+    },
+    first_row, n_rows
+  );
+}
+
+
+template<typename FuncT>
+void BMPReader::foreach_row_segments(const FuncT& row_callback)
+{
+  static_cast<const BMPReader*>(this)->foreach_row_segments(row_callback, 0, _M_height);
+}
+
 
-  /* read bitmap image data, row by row, in bottom-to-top raster scan order */
+template<typename FuncT>
+void BMPReader::foreach_row_segments(const FuncT& row_callback, uint first_row, uint n_rows) const
+{
+  assert(first_row + n_rows <= _M_height);
 
-  auto row_buf = std::make_unique<uint8_t[]>(_M_row_sz);
+  std::vector<RowSegment> segs;
+  segs.reserve(256);
 
-  for (uint row = 0, y = _M_height - 1; row < _M_height; ++row, --y)
+  if (is_rle())
   {
-    if (errno = 0; fread(row_buf.get(), _M_row_sz, 1, _M_file.get()) < 1)
+    RLEDecoder decoder(_M_path, _M_hdr.n_bitmap_offset, rle_size(), _M_width, bpp(), _M_palette);
+
+    if (!_M_emit_top_down)
     {
-      if (errno)
+      for (uint row = 0; row < first_row; ++row)
+        decoder.next_row(segs);
+
+      for (uint row = first_row; row < first_row + n_rows; ++row)
       {
-        throw FLError(FLoc(_M_path),
-                      "Failed to read [bottom-to-top] scanline #{} of bitmap data: {}", row, strerror(errno));
+        decoder.next_row(segs);
+        row_callback(span<const RowSegment>(segs), y_of(row));
       }
-      else
-        throw FLError(FLoc(_M_path), "Unexpected EOF while reading [bottom-to-top] scanline #{}", row);
     }
+    else
+    {
+      // the band's rows are at the end of the data, coming in reverse: collect them, then emit
+      std::vector< std::vector<RowSegment> > band(n_rows);
 
-    uint start_x = 0;
-    auto p_cur = &row_buf[0];
-    BGR cur_color(p_cur);
+      for (uint row = 0; row < _M_height - first_row - n_rows; ++row)
+        decoder.next_row(segs);
 
-    for (uint x = 1; x < _M_width; ++x)
+      for (uint i = n_rows; i-- > 0; )
+        decoder.next_row(band[i]);
+
+      for (uint i = 0; i < n_rows; ++i)
+        row_callback(span<const RowSegment>(band[i]), first_row + i);
+    }
+
+    return;
+  }
+
+  read_rows(first_row, n_rows, [&](const uint8_t* row, uint y)
+  {
+    scan_row(row, segs);
+    row_callback(span<const RowSegment>(segs), y);
+  });
+}
+
+
+template<typename FuncT>
+void BMPReader::read_rows(uint first_row, uint n_rows, const FuncT& row_func) const
+{
+  /* read bitmap image data in blocks of whole rows, in emission order (reading the file backward if need be) */
+
+  const uint rows_per_block = this->rows_per_block();
+  const uint64_t row_sz = _M_row_sz;
+  const bool backward = reads_backward();
+
+  AsyncReader reader(_M_path, band_offset(first_row, n_rows), n_rows * row_sz, rows_per_block * row_sz, READ_DEPTH,
+                     backward);
+
+  const uint end_row = first_row + n_rows;
+
+  for (uint row = first_row; row < end_row; )
+  {
+    size_t block_sz;
+    auto p_block = reader.next(block_sz);
+    assert(p_block); // the blocks cover exactly our rows
+
+    const uint n_block_rows = static_cast<uint>(block_sz / row_sz);
+    const uint n_expected_rows = std::min(rows_per_block, end_row - row);
+
+    if (n_block_rows < n_expected_rows)
+      throw_eof(row, n_expected_rows, n_block_rows);
+
+    if (!backward)
+      for (uint i = 0; i < n_block_rows; ++i, ++row)
+        row_func(p_block + i * row_sz, y_of(row));
+    else
+      for (uint i = n_block_rows; i-- > 0; ++row)
+        row_func(p_block + i * row_sz, y_of(row));
+  }
+}
+
+
+template<uint BPP>
+void BMPReader::scan_indexed_row(const uint8_t* row, std::vector<RowSegment>& segs) const
+{
+  static_assert(BPP == 8 || BPP == 4);
+
+  segs.clear();
+
+  if constexpr (BPP == 8)
+  {
+    const auto run_end = kernels().run_end_idx8;
+
+    for (uint x = 0; x < _M_width; )
     {
-      auto color = BGR(p_cur += 3);
+      const uint end_x = run_end(row, x, _M_width);
+      segs.push_back({ _M_palette[row[x]], end_x });
+      x = end_x;
+    }
+  }
+  else
+  {
+    auto index_at = [row](uint x) -> uint { return (x & 1) ? (row[x / 2] & 0xF) : (row[x / 2] >> 4); };
+    uint cur_index = index_at(0);
 
-      if (cur_color != color)
+    for (uint x = 1; x < _M_width; ++x)
+    {
+      if (auto index = index_at(x); index != cur_index)
       {
-        segment_callback(cur_color, start_x, x, y);
-        cur_color = color;
-        start_x = x;
+        segs.push_back({ _M_palette[cur_index], x });
+        cur_index = index;
       }
     }
 
-    // Final segment in each row will never be recognized by the main loop above, but since we know that
-    // absolutely, we may also unconditionally emit a segment here to complete the row.
-
-    segment_callback(cur_color, start_x, _M_width, y);
+    segs.push_back({ _M_palette[cur_index], _M_width });
   }
 }
 
@@ -0,0 +1,188 @@
+#include "BMPWriter.h"
+
+#include <cerrno>
+#include <cstring>
+#include <limits>
+
+#include <ck2/FileLocation.h>
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+BMPWriter::BMPWriter(const fs::path& path, uint width, uint height)
+: _M_width(width)
+, _M_height(height)
+, _M_bpp(24)
+, _M_rle(false)
+, _M_row_sz( ((width * 24 + 31) / 32) * 4 )
+, _M_rows_written(0)
+, _M_bitmap_sz(0)
+, _M_path(path)
+, _M_file( std::fopen(path.string().c_str(), "wb"), std::fclose )
+, _M_row_buf( std::make_unique<uint8_t[]>(_M_row_sz) ) // zero-initialized, so row padding is always zero
+{
+  init(0, 0);
+}
+
+
+BMPWriter::BMPWriter(const fs::path& path, uint width, uint height, const std::vector<BGR>& palette, bool rle8)
+: _M_width(width)
+, _M_height(height)
+, _M_bpp(8)
+, _M_rle(rle8)
+, _M_row_sz( ((width * 8 + 31) / 32) * 4 )
+, _M_rows_written(0)
+, _M_bitmap_sz(0)
+, _M_palette(palette)
+, _M_path(path)
+, _M_file( std::fopen(path.string().c_str(), "wb"), std::fclose )
+, _M_row_buf( std::make_unique<uint8_t[]>(_M_row_sz) )
+{
+  if (palette.empty() || palette.size() > 256)
+    throw FLError(FLoc(path), "8bpp bitmap palette must have 1-256 colors, but {} were given", palette.size());
+
+  init(static_cast<uint>(palette.size()), (rle8) ? 1 : 0);
+}
+
+
+void BMPWriter::init(uint n_colors, uint32_t compression_type)
+{
+  const auto ferr = FLErrorStaticFactory(FLoc(_M_path));
+
+  if (!_M_file)
+    throw ferr("Failed to open file for writing: {}", strerror(errno));
+
+  memset(&_M_hdr, 0, sizeof(_M_hdr));
+
+  // RLE8 bitmap & file sizes aren't known until close(), so they're filled in then
+  const auto bmp_sz = static_cast<unsigned long long>(_M_row_sz) * _M_height;
+  const auto data_offset = sizeof(_M_hdr) + 4 * n_colors;
+  const auto file_sz = data_offset + bmp_sz;
+
+  if (!_M_rle && file_sz > std::numeric_limits<uint32_t>::max())
+    throw ferr("Bitmap of {}x{} pixels would exceed the 4GB limit of the BMP format", _M_width, _M_height);
+
+  _M_hdr.magic = BMPHeader::MAGIC;
+  _M_hdr.n_file_size = (_M_rle) ? 0 : static_cast<uint32_t>(file_sz);
+  _M_hdr.n_bitmap_offset = static_cast<uint32_t>(data_offset);
+  _M_hdr.n_header_size = 40;
+  _M_hdr.n_width = static_cast<int32_t>(_M_width);
+  _M_hdr.n_height = static_cast<int32_t>(_M_height);
+  _M_hdr.n_planes = 1;
+  _M_hdr.n_bpp = static_cast<uint16_t>(_M_bpp);
+  _M_hdr.compression_type = compression_type;
+  _M_hdr.n_bitmap_size = (_M_rle) ? 0 : static_cast<uint32_t>(bmp_sz);
+  _M_hdr.n_colors = n_colors;
+
+  if (errno = 0; fwrite(&_M_hdr, sizeof(_M_hdr), 1, _M_file.get()) < 1)
+    throw ferr("Failed to write bitmap header: {}", strerror(errno));
+
+  // palette entries are BGRx
+  std::vector<uint8_t> raw_palette;
+  raw_palette.reserve(4 * n_colors);
+
+  for (auto c : _M_palette)
+    raw_palette.insert(raw_palette.end(), { c.blue(), c.green(), c.red(), 0 });
+
+  if (n_colors > 0)
+    if (errno = 0; fwrite(raw_palette.data(), raw_palette.size(), 1, _M_file.get()) < 1)
+      throw ferr("Failed to write bitmap palette: {}", strerror(errno));
+}
+
+
+void BMPWriter::write_row(const uint8_t* row)
+{
+  assert(_M_rows_written < _M_height);
+
+  if (_M_rle)
+  {
+    _M_rle_buf.clear();
+    uint run_start = 0;
+
+    for (uint x = 1; x < _M_width; ++x)
+    {
+      if (row[x] != row[run_start])
+      {
+        encode_run(row[run_start], x - run_start);
+        run_start = x;
+      }
+    }
+
+    encode_run(row[run_start], _M_width - run_start);
+    write_encoded_row();
+    return;
+  }
+
+  if (errno = 0; fwrite(row, _M_row_sz, 1, _M_file.get()) < 1)
+    throw FLError(FLoc(_M_path), "Failed to write row of bitmap data: {}", strerror(errno));
+
+  _M_bitmap_sz += _M_row_sz;
+  ++_M_rows_written;
+}
+
+
+void BMPWriter::repeat_row()
+{
+  if (_M_rle)
+    write_encoded_row();
+  else
+    write_row(_M_row_buf.get());
+}
+
+
+void BMPWriter::encode_run(uint8_t index, uint length)
+{
+  for (; length > 255; length -= 255)
+    _M_rle_buf.insert(_M_rle_buf.end(), { 255, index });
+
+  _M_rle_buf.insert(_M_rle_buf.end(), { static_cast<uint8_t>(length), index });
+}
+
+
+void BMPWriter::write_encoded_row()
+{
+  assert(_M_rows_written < _M_height);
+
+  // every row ends with an end-of-line marker (0,0), except the last, which ends with end-of-bitmap (0,1)
+  const uint8_t eol[2] = { 0, static_cast<uint8_t>( (_M_rows_written + 1 == _M_height) ? 1 : 0 ) };
+
+  if (errno = 0; fwrite(_M_rle_buf.data(), _M_rle_buf.size(), 1, _M_file.get()) < 1 ||
+                 fwrite(eol, sizeof(eol), 1, _M_file.get()) < 1)
+    throw FLError(FLoc(_M_path), "Failed to write row of bitmap data: {}", strerror(errno));
+
+  _M_bitmap_sz += _M_rle_buf.size() + sizeof(eol);
+  ++_M_rows_written;
+}
+
+
+void BMPWriter::close()
+{
+  const auto ferr = FLErrorStaticFactory(FLoc(_M_path));
+
+  if (_M_rows_written != _M_height)
+    throw ferr("Bitmap incomplete: only {} of {} rows were written", _M_rows_written, _M_height);
+
+  if (_M_rle)
+  {
+    // now that the compressed size is known, fill it in
+    const auto file_sz = _M_hdr.n_bitmap_offset + _M_bitmap_sz;
+
+    if (file_sz > std::numeric_limits<uint32_t>::max())
+      throw ferr("RLE8-compressed bitmap of {}x{} pixels exceeds the 4GB limit of the BMP format",
+                 _M_width, _M_height);
+
+    _M_hdr.n_file_size = static_cast<uint32_t>(file_sz);
+    _M_hdr.n_bitmap_size = static_cast<uint32_t>(_M_bitmap_sz);
+
+    if (errno = 0; fseek(_M_file.get(), 0, SEEK_SET) != 0 || fwrite(&_M_hdr, sizeof(_M_hdr), 1, _M_file.get()) < 1)
+      throw ferr("Failed to update bitmap header: {}", strerror(errno));
+  }
+
+  if (auto f = _M_file.release(); fclose(f) != 0)
+    throw ferr("Failed to complete writing file: {}", strerror(errno));
+}
+
+
+//NAMESPACE_CK2_END;
@@ -0,0 +1,153 @@
+#ifndef MAPSCALER_BMP_WRITER_H
+#define MAPSCALER_BMP_WRITER_H
+
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include <ck2/BMPHeader.h>
+#include <ck2/Color.h>
+#include "common.h"
+#include "filesystem.h"
+#include "kernels.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2; // until it is actually in the lib
+
+
+// Writes a bitmap one row at a time, in file order (bottom-to-top). The header is written upon construction, and
+// close() must be called once all rows have been written to catch any errors on completion.
+//
+// Bitmaps are 24bpp unless constructed with a palette, in which case they're 8bpp indexed and, by default,
+// RLE8-compressed. Indexed layers (terrain, regions, etc.) are mostly long runs of few colors, so RLE8 output
+// is usually a small fraction of the uncompressed size. Runs are only ever written in encoded mode, so
+// pathological rows of single pixels cost at most twice their uncompressed size.
+
+struct BMPWriter
+{
+  BMPWriter(const fs::path&, uint width, uint height);
+  BMPWriter(const fs::path&, uint width, uint height, const std::vector<BGR>& palette, bool rle8 = true);
+
+  auto& path()         const noexcept { return _M_path; }
+  auto  width()        const noexcept { return _M_width; }
+  auto  height()       const noexcept { return _M_height; }
+  auto  bpp()          const noexcept { return _M_bpp; }
+  auto  is_rle()       const noexcept { return _M_rle; }
+  auto  row_size()     const noexcept { return _M_row_sz; } // uncompressed
+  auto  rows_written() const noexcept { return _M_rows_written; }
+
+  // Write the next row from raw, already-padded pixel data (row_size() bytes). If RLE8-compressing, the raw row
+  // of indices is encoded first.
+  void write_row(const uint8_t* row);
+
+  // Blit the next row from a row of segments (anything with .id and .end), resolving segment IDs to colors with
+  // color_of(id). 24bpp only.
+  template<typename RowT, typename ColorFuncT>
+  void write_segments(const RowT&, const ColorFuncT& color_of);
+
+  // Indexed counterpart to write_segments: segment IDs are resolved to palette indices with index_of(id). When
+  // RLE8-compressing, segments are encoded directly as runs (no pixels are blitted).
+  template<typename RowT, typename IndexFuncT>
+  void write_indexed_segments(const RowT&, const IndexFuncT& index_of);
+
+  // Write the row last written by write_segments() or write_indexed_segments() again.
+  void repeat_row();
+
+  void close();
+
+private:
+  void init(uint n_colors, uint32_t compression_type);
+  void encode_run(uint8_t index, uint length);
+  void write_encoded_row();
+
+  uint                       _M_width;
+  uint                       _M_height;
+  uint                       _M_bpp;
+  bool                       _M_rle;
+  uint                       _M_row_sz;
+  uint                       _M_rows_written;
+  uint64_t                   _M_bitmap_sz; // bytes of bitmap data written so far
+  BMPHeader                  _M_hdr;
+  std::vector<BGR>           _M_palette;
+  fs::path                   _M_path;
+  unique_fptr                _M_file;
+  std::unique_ptr<uint8_t[]> _M_row_buf;
+  std::vector<uint8_t>       _M_rle_buf;   // last encoded row (sans end-of-line marker)
+};
+
+
+template<typename RowT, typename ColorFuncT>
+void BMPWriter::write_segments(const RowT& row, const ColorFuncT& color_of)
+{
+  assert( !row.empty() );
+  assert(_M_bpp == 24);
+
+  uint start_x = 0;
+  auto p_out = &_M_row_buf[0];
+
+  // BLIT BLIT BLIT LIKE THE MADMAN THAT YOU ALWAYS WANTED TO BE!
+  const auto fill = kernels().fill_bgr24;
+
+  for (const auto& seg : row)
+  {
+    fill(p_out, seg.end - start_x, color_of(seg.id));
+    p_out += 3 * static_cast<size_t>(seg.end - start_x);
+    start_x = seg.end;
+  }
+
+  assert(start_x == _M_width);
+  write_row(_M_row_buf.get());
+}
+
+
+template<typename RowT, typename IndexFuncT>
+void BMPWriter::write_indexed_segments(const RowT& row, const IndexFuncT& index_of)
+{
+  assert( !row.empty() );
+  assert(_M_bpp == 8);
+
+  uint start_x = 0;
+
+  if (_M_rle)
+  {
+    _M_rle_buf.clear();
+
+    // adjacent segments with different IDs may well share an index, so merge them into one run
+    uint8_t run_index = static_cast<uint8_t>( index_of(row.begin()->id) );
+    uint run_start = 0;
+
+    for (const auto& seg : row)
+    {
+      const uint8_t index = static_cast<uint8_t>( index_of(seg.id) );
+
+      if (index != run_index)
+      {
+        encode_run(run_index, start_x - run_start);
+        run_index = index;
+        run_start = start_x;
+      }
+
+      start_x = seg.end;
+    }
+
+    assert(start_x == _M_width);
+    encode_run(run_index, start_x - run_start);
+    write_encoded_row();
+    return;
+  }
+
+  for (const auto& seg : row)
+  {
+    memset(&_M_row_buf[start_x], static_cast<uint8_t>( index_of(seg.id) ), seg.end - start_x);
+    start_x = seg.end;
+  }
+
+  assert(start_x == _M_width);
+  write_row(_M_row_buf.get());
+}
+
+
+//NAMESPACE_CK2_END;
+#endif
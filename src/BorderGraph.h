@@ -0,0 +1,430 @@
+#ifndef MAPSCALER_BORDER_GRAPH_H
+#define MAPSCALER_BORDER_GRAPH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#include "SegmentMap.h"
+#include "common.h"
+#include "parallel.h"
+
+
+// The planar graph of all borders in a SegmentMap. Borders run along cracks, the unit lattice edges between pixels
+// of different entities (or between a pixel & the outside of the map), with lattice point (x, y) being the top-left
+// corner of pixel (x, y). Nodes are junctions, where three or more cracks meet, and each edge is a maximal chain
+// of cracks between two junctions, stored as the polyline of its corners. Every border between two entities is
+// thus represented exactly once, shared by both sides, so anything done to the edges (e.g., simplification)
+// keeps the map watertight.
+//
+// A border which closes on itself without meeting any junction (an enclave entirely surrounded by one other
+// entity) gets a node of its own where its chain starts & ends.
+//
+// Sides are given relative to the direction of the polyline, in image coordinates (y grows downward): walking
+// from `from` to `to`, `left` lies on the walker's left-hand side. Edges along the map's outline are oriented so
+// that the outside is always on their right.
+
+template<typename EntityT>
+struct BorderGraph
+{
+  struct Point
+  {
+    uint x, y;
+
+    bool operator==(const Point& o) const noexcept { return x == o.x && y == o.y; }
+    bool operator!=(const Point& o) const noexcept { return !(*this == o); }
+  };
+
+  struct Edge
+  {
+    uint    from, to;    // node indices
+    EntityT left, right; // (right is meaningless if outer)
+    bool    outer;       // along the map's outline
+    uint    length;      // number of cracks
+  };
+
+  BorderGraph() : _M_point_offsets(1, 0), _M_node_offsets(1, 0) {}
+
+  auto n_nodes() const noexcept { return static_cast<uint>(_M_nodes.size()); }
+  auto n_edges() const noexcept { return static_cast<uint>(_M_edges.size()); }
+
+  auto& nodes() const noexcept { return _M_nodes; }
+  auto& node(uint n) const noexcept { return _M_nodes[n]; }
+  auto& edges() const noexcept { return _M_edges; }
+  auto& edge(uint e) const noexcept { return _M_edges[e]; }
+
+  // Corners of edge `e` from its `from` node to its `to` node, both included
+  span<const Point> points(uint e) const noexcept
+  {
+    return { _M_points.data() + _M_point_offsets[e], _M_point_offsets[e + 1] - _M_point_offsets[e] };
+  }
+
+  // Edges incident to node `n` (an edge which starts & ends at `n` is listed twice)
+  span<const uint> node_edges(uint n) const noexcept
+  {
+    return { _M_node_edges.data() + _M_node_offsets[n], _M_node_offsets[n + 1] - _M_node_offsets[n] };
+  }
+
+  template<typename E, typename C>
+  friend BorderGraph<E> extract_border_graph(const SegmentMap<E, C>&);
+
+private:
+  std::vector<Point> _M_nodes;
+  std::vector<Edge>  _M_edges;
+  std::vector<uint>  _M_point_offsets; // n_edges() + 1 offsets into _M_points
+  std::vector<Point> _M_points;
+  std::vector<uint>  _M_node_offsets;  // n_nodes() + 1 offsets into _M_node_edges
+  std::vector<uint>  _M_node_edges;
+};
+
+
+namespace bg_detail {
+
+constexpr uint NONE = std::numeric_limits<uint>::max();
+
+// A lattice point on which cracks end, meet, or pass from one row into the next. Lattice row y holds the points
+// at which the segment boundaries of pixel rows y-1 & y touch it (including the outline's, at x = 0 & width), and
+// the cracks along the lattice row only ever start or end at such points, so these are all the points a border
+// can turn or branch at.
+struct LatticePoint
+{
+  uint x;
+  uint up   = NONE; // point at the other end of the vertical crack above, if any
+  uint down = NONE; // ... below
+  bool left = false; // crack along the lattice row to the previous point of the row
+  bool right = false; // ... to the next one
+  bool has_up = false, has_down = false; // (before linking)
+};
+
+enum Dir { RIGHT, DOWN, LEFT, UP };
+
+}
+
+
+// Extract the border graph. Lattice rows are built from consecutive pixel row pairs in parallel bands (a merge
+// of the two rows' segment boundaries, which also tells which stretches between them have differing entities on
+// either side), then vertically linked, and finally the chains are walked from every junction. Everything is
+// linear in the number of segments: long vertical borders take a step per row they cross, and horizontal ones a
+// step per stretch, however wide.
+
+template<typename EntityT, typename CoordT>
+BorderGraph<EntityT> extract_border_graph(const SegmentMap<EntityT, CoordT>& map)
+{
+  using namespace bg_detail;
+  using Graph = BorderGraph<EntityT>;
+
+  const uint width = map.width(), height = map.height();
+  Graph g;
+
+  if (width == 0 || height == 0)
+    return g;
+
+  /* build the points of each lattice row, 0..height */
+
+  const uint n_lrows = height + 1;
+  std::vector< std::vector<LatticePoint> > band_points( max_bands(n_lrows, 64) );
+  std::vector<uint> row_offsets(n_lrows + 1, 0); // filled with per-row counts first
+
+  const uint n_bands = parallel_bands(n_lrows, [&](uint band, uint y_begin, uint y_end)
+  {
+    auto& pts = band_points[band];
+
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      const size_t first = pts.size();
+      const bool outline = (y == 0 || y == height);
+
+      // (the vertical outline cracks are boundaries of every row, at 0 & at width, just like segment ends)
+      static const typename SegmentMap<EntityT, CoordT>::Row no_row;
+      const auto& above = (y > 0) ? map[y - 1] : no_row;
+      const auto& below = (y < height) ? map[y] : no_row;
+
+      size_t i = 0, j = 0; // current segment of each row
+      uint x = 0;
+
+      for (;;)
+      {
+        // (the leftmost point of the row is x = 0, where the outline's vertical cracks are)
+        LatticePoint p;
+        p.x = x;
+        p.has_up = (y > 0);
+        p.has_down = (y < height);
+
+        if (x > 0)
+        {
+          // (a boundary between two segments of the same entity isn't a crack)
+          if (y > 0 && x < width)
+            p.has_up = (i > 0 && above[i - 1].end == x && above[i - 1].id != above[i].id);
+
+          if (y < height && x < width)
+            p.has_down = (j > 0 && below[j - 1].end == x && below[j - 1].id != below[j].id);
+
+          p.left = pts.back().right;
+        }
+
+        if (x == width)
+        {
+          pts.push_back(p);
+          break;
+        }
+
+        // Stretch up to the next boundary of either row, along which the entities above & below are constant
+        const uint end_a = (y > 0) ? uint(above[i].end) : width;
+        const uint end_b = (y < height) ? uint(below[j].end) : width;
+        const uint next_x = std::min(end_a, end_b);
+
+        p.right = outline || above[i].id != below[j].id;
+        pts.push_back(p);
+
+        if (y > 0 && end_a == next_x) ++i;
+        if (y < height && end_b == next_x) ++j;
+        x = next_x;
+      }
+
+      row_offsets[y + 1] = static_cast<uint>(pts.size() - first);
+    }
+  }, 64);
+
+  for (uint y = 0; y < n_lrows; ++y)
+    row_offsets[y + 1] += row_offsets[y];
+
+  std::vector<LatticePoint> pts;
+  pts.reserve(row_offsets.back());
+
+  for (uint band = 0; band < n_bands; ++band)
+  {
+    pts.insert(pts.end(), band_points[band].begin(), band_points[band].end());
+    band_points[band] = {};
+  }
+
+  /* link vertical cracks between consecutive lattice rows */
+
+  parallel_bands(height, [&](uint, uint y_begin, uint y_end)
+  {
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      uint p = row_offsets[y], q = row_offsets[y + 1];
+      const uint p_end = row_offsets[y + 1], q_end = row_offsets[y + 2];
+
+      // Both rows' vertical-crack points are exactly pixel row y's boundaries, so they pair up in order.
+      for (;; ++p, ++q)
+      {
+        while (p < p_end && !pts[p].has_down) ++p;
+        while (q < q_end && !pts[q].has_up) ++q;
+
+        if (p == p_end || q == q_end)
+          break;
+
+        assert(pts[p].x == pts[q].x);
+        pts[p].down = q;
+        pts[q].up = p;
+      }
+    }
+  }, 256);
+
+  /* walk the chains */
+
+  auto has = [&](uint p, Dir d)
+  {
+    switch (d)
+    {
+      case RIGHT: return pts[p].right;
+      case DOWN:  return pts[p].down != NONE;
+      case LEFT:  return pts[p].left;
+      default:    return pts[p].up != NONE;
+    }
+  };
+
+  auto step = [&](uint p, Dir d)
+  {
+    switch (d)
+    {
+      case RIGHT: return p + 1;
+      case DOWN:  return pts[p].down;
+      case LEFT:  return p - 1;
+      default:    return pts[p].up;
+    }
+  };
+
+  auto degree = [&](uint p) { return uint(has(p, RIGHT)) + has(p, DOWN) + has(p, LEFT) + has(p, UP); };
+
+  // Each crack is marked visited at its left or upper end
+  std::vector<bool> visited_h(pts.size(), false), visited_v(pts.size(), false);
+
+  auto visited = [&](uint p, Dir d) -> std::vector<bool>::reference
+  {
+    switch (d)
+    {
+      case RIGHT: return visited_h[p];
+      case DOWN:  return visited_v[p];
+      case LEFT:  return visited_h[p - 1];
+      default:    return visited_v[ pts[p].up ];
+    }
+  };
+
+  std::vector<uint> node_of(pts.size(), NONE);
+
+  auto add_node = [&](uint p, uint y)
+  {
+    if (node_of[p] == NONE)
+    {
+      node_of[p] = g.n_nodes();
+      g._M_nodes.push_back({ pts[p].x, y });
+    }
+
+    return node_of[p];
+  };
+
+  // Entity on either side of the crack leaving lattice point (x, y) in direction d, or `outside`
+  auto sides = [&](uint x, uint y, Dir d, EntityT& left, EntityT& right, bool& left_out, bool& right_out)
+  {
+    // pixels NW, NE, SW, SE of the lattice point
+    auto pixel = [&](int px, int py, EntityT& id)
+    {
+      if (px < 0 || py < 0 || px >= int(width) || py >= int(height))
+        return false;
+
+      id = map.id_at(uint(px), uint(py));
+      return true;
+    };
+
+    const int ix = int(x), iy = int(y);
+
+    switch (d)
+    {
+      case RIGHT: left_out = !pixel(ix, iy - 1, left);     right_out = !pixel(ix, iy, right);         break;
+      case DOWN:  left_out = !pixel(ix, iy, left);         right_out = !pixel(ix - 1, iy, right);     break;
+      case LEFT:  left_out = !pixel(ix - 1, iy, left);     right_out = !pixel(ix - 1, iy - 1, right); break;
+      default:    left_out = !pixel(ix - 1, iy - 1, left); right_out = !pixel(ix, iy - 1, right);     break;
+    }
+  };
+
+  auto walk = [&](uint p0, uint y0, Dir d0)
+  {
+    typename Graph::Edge e;
+    e.from = node_of[p0];
+    e.length = 0;
+
+    bool left_out = false, right_out = false;
+    sides(pts[p0].x, y0, d0, e.left, e.right, left_out, right_out);
+
+    const size_t first_point = g._M_points.size();
+    g._M_points.push_back({ pts[p0].x, y0 });
+
+    uint p = p0, y = y0;
+    Dir d = d0;
+
+    for (;;)
+    {
+      visited(p, d) = true;
+      const uint q = step(p, d);
+      const uint prev_x = pts[p].x;
+
+      if (d == DOWN) ++y;
+      else if (d == UP) --y;
+
+      e.length += (d == RIGHT || d == LEFT) ? (pts[q].x > prev_x ? pts[q].x - prev_x : prev_x - pts[q].x) : 1;
+      p = q;
+
+      if (node_of[p] != NONE)
+        break;
+
+      // A degree-2 point: leave by the crack we didn't come in by
+      const Dir back = Dir((d + 2) % 4);
+      Dir next = d;
+
+      for (Dir c : { RIGHT, DOWN, LEFT, UP })
+        if (c != back && has(p, c))
+          next = c;
+
+      if (next != d)
+        g._M_points.push_back({ pts[p].x, y });
+
+      d = next;
+    }
+
+    g._M_points.push_back({ pts[p].x, y });
+    e.to = node_of[p];
+    e.outer = left_out || right_out;
+
+    if (left_out) // orient outline edges so the outside is on the right
+    {
+      std::reverse(g._M_points.begin() + static_cast<ptrdiff_t>(first_point), g._M_points.end());
+      std::swap(e.from, e.to);
+      e.left = e.right;
+    }
+
+    g._M_edges.push_back(e);
+    g._M_point_offsets.push_back( static_cast<uint>(g._M_points.size()) );
+  };
+
+  uint y = 0;
+
+  for (uint p = 0; p < pts.size(); ++p)
+  {
+    while (p >= row_offsets[y + 1]) ++y;
+
+    if (degree(p) >= 3)
+      add_node(p, y);
+  }
+
+  y = 0;
+
+  for (uint p = 0; p < pts.size(); ++p)
+  {
+    while (p >= row_offsets[y + 1]) ++y;
+
+    if (node_of[p] == NONE)
+      continue;
+
+    for (Dir d : { RIGHT, DOWN, LEFT, UP })
+      if (has(p, d) && !visited(p, d))
+        walk(p, y, d);
+  }
+
+  // Whatever is left are closed chains without junctions. Starting each at its first point in scan order (its
+  // top-left corner) also gives them a consistent orientation: rightward, with the enclosed entity on the right.
+
+  y = 0;
+
+  for (uint p = 0; p < pts.size(); ++p)
+  {
+    while (p >= row_offsets[y + 1]) ++y;
+
+    if (has(p, RIGHT) && !visited(p, RIGHT))
+    {
+      add_node(p, y);
+      walk(p, y, RIGHT);
+    }
+  }
+
+  /* incidence lists */
+
+  std::vector<uint> degree_of(g.n_nodes() + 1, 0);
+
+  for (const auto& e : g._M_edges)
+  {
+    ++degree_of[e.from];
+    ++degree_of[e.to];
+  }
+
+  g._M_node_offsets.assign(g.n_nodes() + 1, 0);
+
+  for (uint n = 0; n < g.n_nodes(); ++n)
+    g._M_node_offsets[n + 1] = g._M_node_offsets[n] + degree_of[n];
+
+  g._M_node_edges.resize(g._M_node_offsets.back());
+  std::vector<uint> fill(g._M_node_offsets.begin(), g._M_node_offsets.end() - 1);
+
+  for (uint e = 0; e < g.n_edges(); ++e)
+  {
+    g._M_node_edges[ fill[ g._M_edges[e].from ]++ ] = e;
+    g._M_node_edges[ fill[ g._M_edges[e].to ]++ ] = e;
+  }
+
+  return g;
+}
+
+
+#endif
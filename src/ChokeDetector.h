@@ -0,0 +1,232 @@
+#ifndef MAPSCALER_CHOKE_DETECTOR_H
+#define MAPSCALER_CHOKE_DETECTOR_H
+
+#include <algorithm>
+#include <vector>
+
+#include "SegmentMap.h"
+#include "common.h"
+#include "parallel.h"
+
+
+// Finds the places where an entity is at risk of falling apart in the game's eyes:
+//
+//   - diagonal links: two pixels of the entity touching only at a corner, with both other pixels of the 2x2 block
+//     belonging to something else. The game only knows 4-connectivity, so this is a break unless the two sides are
+//     also connected some other way (which label_components() with 4- vs. 8-connectivity can tell).
+//   - narrow places: stretches of the entity fewer than `min_width` pixels wide, either horizontally (a short run
+//     between two other entities) or vertically (a column of fewer than `min_width` pixels, reported as the
+//     horizontal extent of the stretch & the rows it spans). The map's edges don't widen anything.
+//
+// Everything is found in one pass over consecutive row pairs, linear in the number of segments, so it's cheap
+// enough to run on every scaling result.
+
+enum class ChokeKind { diagonal, narrow_x, narrow_y };
+
+template<typename EntityT>
+struct Choke
+{
+  ChokeKind kind;
+  EntityT   id;
+  uint      x1, x2; // [x1, x2): for diagonal links, the 2x2 block around the corner
+  uint      y1, y2; // [y1, y2)
+};
+
+
+namespace choke_detail {
+
+// A stretch of a row in which the entity & the number of consecutive rows (capped) it has had at each column are
+// constant
+template<typename EntityT>
+struct Column
+{
+  uint    x1, x2;
+  EntityT id;
+  uint    height;
+};
+
+}
+
+
+// Bands of rows are scanned in parallel. A column of the entity can only be narrow if it began fewer than
+// `min_width` rows before it ends, so each band warms up its column heights on the `min_width` rows before it;
+// a column is reported by the band holding its last row.
+
+template<typename EntityT, typename CoordT>
+std::vector< Choke<EntityT> > find_chokes(const SegmentMap<EntityT, CoordT>& map, uint min_width = 2)
+{
+  using Column = choke_detail::Column<EntityT>;
+
+  const uint height = map.height();
+  std::vector< std::vector< Choke<EntityT> > > band_chokes( max_bands(height, 64) );
+
+  const uint n_bands = parallel_bands(height, [&](uint band, uint y_begin, uint y_end)
+  {
+    auto& chokes = band_chokes[band];
+
+    std::vector<Column> columns, next_columns;
+    std::vector<size_t> open_runs, next_open_runs; // narrow_x chokes reaching the row above, by x
+
+    auto add_column = [&](uint x1, uint x2, EntityT id, uint h)
+    {
+      if (!next_columns.empty() && next_columns.back().id == id && next_columns.back().height == h &&
+          next_columns.back().x2 == x1)
+        next_columns.back().x2 = x2;
+      else
+        next_columns.push_back({ x1, x2, id, h });
+    };
+
+    // [x1, x2) of column `c` had its last row at y - 1
+    auto column_ended = [&](const Column& c, uint x1, uint x2, uint y)
+    {
+      if (c.height >= min_width || y <= y_begin)
+        return;
+
+      // (pieces of one stretch are reported left to right with nothing in between)
+      if (!chokes.empty() && chokes.back().kind == ChokeKind::narrow_y && chokes.back().id == c.id &&
+          chokes.back().y1 == y - c.height && chokes.back().y2 == y && chokes.back().x2 == x1)
+        chokes.back().x2 = x2;
+      else
+        chokes.push_back({ ChokeKind::narrow_y, c.id, x1, x2, y - c.height, y });
+    };
+
+    const uint y_warmup = (y_begin > min_width) ? y_begin - min_width : 0;
+
+    for (uint y = y_warmup; y <= y_end; ++y)
+    {
+      if (y == height) // the bottom edge ends every column
+      {
+        for (const auto& c : columns)
+          column_ended(c, c.x1, c.x2, y);
+
+        break;
+      }
+
+      if (y > y_warmup && y != y_begin && map.same_row(y, y - 1))
+      {
+        // Identical rows: every column grows, none ends, narrow runs carry on and there are no corners
+        for (auto& c : columns)
+          c.height = std::min(c.height + 1, min_width);
+
+        if (y < y_end)
+          for (size_t i : open_runs)
+            ++chokes[i].y2;
+
+        continue;
+      }
+
+      const auto& row = map[y];
+
+      /* columns: grow those continuing into this row, end the others */
+
+      next_columns.clear();
+      size_t ci = 0;
+      uint x = 0;
+
+      for (const auto& seg : row)
+      {
+        const uint seg_end = seg.end;
+
+        while (x < seg_end)
+        {
+          // (on the first row, there's nothing to continue)
+          const Column* p_c = (ci < columns.size()) ? &columns[ci] : nullptr;
+          const uint end = p_c ? std::min(seg_end, p_c->x2) : seg_end;
+
+          if (p_c && p_c->id == seg.id)
+            add_column(x, end, seg.id, std::min(p_c->height + 1, min_width));
+          else
+          {
+            if (p_c)
+              column_ended(*p_c, x, end, y);
+
+            add_column(x, end, seg.id, 1);
+          }
+
+          x = end;
+
+          if (p_c && p_c->x2 == end)
+            ++ci;
+        }
+      }
+
+      columns.swap(next_columns);
+
+      if (y < y_begin || y == y_end)
+        continue;
+
+      /* narrow runs (adjacent segments of one entity count as one run) */
+
+      next_open_runs.clear();
+      size_t oi = 0;
+
+      for (size_t i = 0, start_x = 0; i < row.size(); )
+      {
+        size_t k = i;
+        while (k + 1 < row.size() && row[k + 1].id == row[i].id) ++k;
+
+        const uint end_x = row[k].end;
+
+        if (end_x - start_x < min_width)
+        {
+          // (continue the same run on the row above)
+          while (oi < open_runs.size() && chokes[ open_runs[oi] ].x1 < start_x) ++oi;
+
+          if (oi < open_runs.size() && chokes[ open_runs[oi] ].x1 == start_x &&
+              chokes[ open_runs[oi] ].x2 == end_x && chokes[ open_runs[oi] ].id == row[i].id)
+          {
+            ++chokes[ open_runs[oi] ].y2;
+            next_open_runs.push_back(open_runs[oi]);
+          }
+          else
+          {
+            next_open_runs.push_back(chokes.size());
+            chokes.push_back({ ChokeKind::narrow_x, row[i].id, uint(start_x), end_x, y, y + 1 });
+          }
+        }
+
+        start_x = end_x;
+        i = k + 1;
+      }
+
+      open_runs.swap(next_open_runs);
+
+      /* diagonal links, at the corners where a segment boundary of the row above meets one of this row */
+
+      if (y == 0)
+        continue;
+
+      const auto& above = map[y - 1];
+      size_t i = 0, j = 0;
+
+      while (i + 1 < above.size() && j + 1 < row.size())
+      {
+        const uint end_a = above[i].end, end_b = row[j].end;
+
+        if (end_a == end_b)
+        {
+          const EntityT nw = above[i].id, ne = above[i + 1].id, sw = row[j].id, se = row[j + 1].id;
+
+          if (nw == se && ne != nw && sw != nw)
+            chokes.push_back({ ChokeKind::diagonal, nw, end_a - 1, end_a + 1, y - 1, y + 1 });
+
+          if (ne == sw && nw != ne && se != ne)
+            chokes.push_back({ ChokeKind::diagonal, ne, end_a - 1, end_a + 1, y - 1, y + 1 });
+        }
+
+        if (end_a <= end_b) ++i;
+        if (end_b <= end_a) ++j;
+      }
+    }
+  }, 64);
+
+  std::vector< Choke<EntityT> > chokes;
+
+  for (uint band = 0; band < n_bands; ++band)
+    chokes.insert(chokes.end(), band_chokes[band].begin(), band_chokes[band].end());
+
+  return chokes;
+}
+
+
+#endif
@@ -0,0 +1,28 @@
+#include "ColorIndex.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+ColorIndex::ColorIndex(const DefinitionsTable& def_tbl)
+{
+  _M_map.reserve(def_tbl.size() + 2);
+
+  for (const auto& row : def_tbl)
+    insert(BGR(row.color.blue(), row.color.green(), row.color.red()), row.id); // definitions are in RGB
+}
+
+
+bool ColorIndex::insert(BGR color, prov_id_t id)
+{
+  auto [it, inserted] = _M_map.emplace(color, id);
+
+  if (!inserted)
+    _M_dups.push_back({ color, it->second, id });
+
+  return inserted;
+}
+
+
+//NAMESPACE_CK2_END;
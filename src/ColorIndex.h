@@ -0,0 +1,57 @@
+#ifndef MAPSCALER_COLOR_INDEX_H
+#define MAPSCALER_COLOR_INDEX_H
+
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <ck2/Color.h>
+#include <ck2/DefinitionsTable.h>
+#include <ck2/common.h>
+#include "common.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2; // until it is actually in the lib
+
+
+// Maps province colors (as they are found in the provinces bitmap, i.e. BGR) to province IDs. Colors which are
+// claimed by more than one definition are kept on record (the first definition wins) rather than silently dropped,
+// since that's always a defect of the map.
+
+struct ColorIndex
+{
+  struct Duplicate
+  {
+    BGR       color;
+    prov_id_t id;     // province that owns the color in this index
+    prov_id_t dup_id; // province whose definition was rejected
+  };
+
+  ColorIndex(const DefinitionsTable&);
+
+  // Add a color mapping which doesn't come from the definitions (e.g., reserved ocean/impassable colors).
+  // Returns false (and records the duplicate) if the color was already mapped.
+  bool insert(BGR, prov_id_t);
+  bool insert(const std::pair<BGR, prov_id_t>& p) { return insert(p.first, p.second); }
+
+  // nullptr if the color has no province
+  const prov_id_t* find(BGR color) const noexcept
+  {
+    auto it = _M_map.find(color);
+    return (it == _M_map.end()) ? nullptr : &it->second;
+  }
+
+  auto& duplicates() const noexcept { return _M_dups; }
+  auto  size()       const noexcept { return _M_map.size(); }
+  auto  begin()      const noexcept { return _M_map.cbegin(); }
+  auto  end()        const noexcept { return _M_map.cend(); }
+
+private:
+  std::unordered_map<BGR, prov_id_t> _M_map;
+  std::vector<Duplicate>             _M_dups;
+};
+
+
+//NAMESPACE_CK2_END;
+#endif
@@ -0,0 +1,318 @@
+#ifndef MAPSCALER_CONNECTED_COMPONENTS_H
+#define MAPSCALER_CONNECTED_COMPONENTS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "SegmentMap.h"
+#include "common.h"
+#include "parallel.h"
+
+
+// Connected-component labeling of a SegmentMap, done on its segments (runs) rather than its pixels: two runs are
+// connected if they have the same entity ID and touch, either side by side within a row or overlapping between
+// consecutive rows (or, with 8-connectivity, also just diagonally at a corner).
+//
+// Components are numbered in order of their first run (top-to-bottom, left-to-right), and for each component we
+// know its entity, bounding box, area, and whether it touches the map's edge (an ocean component which doesn't is
+// a lake). Components are also grouped by entity, so whether a province is one contiguous region is a lookup.
+
+enum class Connectivity { four, eight };
+
+
+template<typename EntityT> struct ComponentLabeling;
+
+template<typename EntityT, typename CoordT>
+ComponentLabeling<EntityT> label_components(const SegmentMap<EntityT, CoordT>&,
+                                            Connectivity = Connectivity::four);
+
+
+template<typename EntityT>
+struct ComponentLabeling
+{
+  struct Component
+  {
+    EntityT  id;
+    uint     x1, x2;        // [x1, x2)
+    uint     y1, y2;        // [y1, y2)
+    uint64_t area;          // in pixels
+    bool     touches_edge;
+  };
+
+  auto  n_components() const noexcept { return static_cast<uint>(_M_components.size()); }
+  auto& components()   const noexcept { return _M_components; }
+  auto& component(uint c) const noexcept { return _M_components[c]; }
+
+  // Component of the i-th segment of row y
+  uint label(uint y, uint i) const noexcept { return _M_labels[ _M_row_offsets[y] + i ]; }
+
+  // Distinct entity IDs in the map, ascending
+  auto& ids() const noexcept { return _M_ids; }
+
+  // Components of entity `id`, in component order (empty if the entity doesn't occur in the map)
+  auto components_begin(EntityT id) const noexcept { return _M_by_id.begin() + _M_id_offsets[id_index(id)]; }
+  auto components_end(EntityT id)   const noexcept { return _M_by_id.begin() + _M_id_offsets[id_index(id) + 1]; }
+
+  uint n_components(EntityT id) const noexcept
+  {
+    const uint i = id_index(id);
+    return _M_id_offsets[i + 1] - _M_id_offsets[i];
+  }
+
+  // Entities made up of more than one component, ascending
+  std::vector<EntityT> fragmented() const
+  {
+    std::vector<EntityT> v;
+
+    for (uint i = 0; i < _M_ids.size(); ++i)
+      if (_M_id_offsets[i + 1] - _M_id_offsets[i] > 1)
+        v.push_back(_M_ids[i]);
+
+    return v;
+  }
+
+  template<typename E, typename C>
+  friend ComponentLabeling<E> label_components(const SegmentMap<E, C>&, Connectivity);
+
+private:
+  // Index of `id` in ids(), or ids().size() (whose range in _M_id_offsets is empty) if it doesn't occur
+  uint id_index(EntityT id) const noexcept
+  {
+    auto it = std::lower_bound(_M_ids.begin(), _M_ids.end(), id);
+    return (it != _M_ids.end() && *it == id) ? static_cast<uint>(it - _M_ids.begin())
+                                             : static_cast<uint>(_M_ids.size());
+  }
+
+  std::vector<Component> _M_components;
+  std::vector<uint>      _M_row_offsets; // height + 1 offsets into _M_labels
+  std::vector<uint>      _M_labels;      // component per segment, row by row
+  std::vector<EntityT>   _M_ids;
+  std::vector<uint>      _M_id_offsets;  // ids().size() + 2 offsets into _M_by_id (the last range being empty)
+  std::vector<uint>      _M_by_id;       // component indices grouped by entity
+};
+
+
+namespace cc_detail {
+
+// Lock-free union-find over run indices. Roots always link toward the smaller index, so the final root of every
+// set is its first run, whatever order the unions happened in; concurrent unions retry on a failed CAS, and
+// finds halve paths as they go (benignly racing, as any parent they install is still an ancestor).
+struct ConcurrentUnionFind
+{
+  explicit ConcurrentUnionFind(uint n) : _M_parent(n) {}
+
+  std::atomic<uint>& operator[](uint i) noexcept { return _M_parent[i]; }
+
+  uint find(uint x) noexcept
+  {
+    for (;;)
+    {
+      uint p = _M_parent[x].load(std::memory_order_relaxed);
+
+      if (p == x)
+        return x;
+
+      const uint gp = _M_parent[p].load(std::memory_order_relaxed);
+
+      if (gp != p)
+        _M_parent[x].compare_exchange_weak(p, gp, std::memory_order_relaxed);
+
+      x = gp;
+    }
+  }
+
+  void unite(uint a, uint b) noexcept
+  {
+    for (;;)
+    {
+      a = find(a);
+      b = find(b);
+
+      if (a == b)
+        return;
+
+      if (a < b)
+        std::swap(a, b);
+
+      // (a is the larger root; it only stops being a root if another union beat us to it, in which case retry)
+      uint expected = a;
+
+      if (_M_parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed))
+        return;
+    }
+  }
+
+private:
+  std::vector< std::atomic<uint> > _M_parent;
+};
+
+}
+
+
+// Label the map's components in time linear in its number of segments. Bands of rows are labeled in parallel,
+// each uniting only runs within the band, and then the runs on either side of each band boundary are united in a
+// second parallel step. (The union-find is lock-free, so the two steps need no coordination beyond the join.)
+// Rows which share storage with the row above are identical to it, so their runs are united pairwise without a
+// merge walk.
+
+template<typename EntityT, typename CoordT>
+ComponentLabeling<EntityT> label_components(const SegmentMap<EntityT, CoordT>& map, Connectivity connectivity)
+{
+  const uint n_rows = map.height();
+  const bool diagonal = (connectivity == Connectivity::eight);
+
+  ComponentLabeling<EntityT> cl;
+  cl._M_row_offsets.assign(n_rows + 1, 0);
+
+  for (uint y = 0; y < n_rows; ++y)
+    cl._M_row_offsets[y + 1] = cl._M_row_offsets[y] + static_cast<uint>(map[y].size());
+
+  const auto& offsets = cl._M_row_offsets;
+  const uint n_runs = offsets.back();
+  cc_detail::ConcurrentUnionFind uf(n_runs);
+
+  // Unite the runs of row y with those of row y-1 which they touch
+  auto unite_rows = [&](uint y)
+  {
+    const auto& above = map[y - 1];
+    const auto& row = map[y];
+    const uint base_a = offsets[y - 1], base_b = offsets[y];
+
+    if (map.same_row(y, y - 1))
+    {
+      for (uint i = 0; i < row.size(); ++i)
+        uf.unite(base_a + i, base_b + i);
+
+      return;
+    }
+
+    size_t i = 0, j = 0;
+
+    while (i < above.size() && j < row.size())
+    {
+      if (above[i].id == row[j].id)
+        uf.unite(base_a + static_cast<uint>(i), base_b + static_cast<uint>(j));
+
+      const uint end_a = above[i].end, end_b = row[j].end;
+
+      if (end_a == end_b)
+      {
+        // Both runs end at the same x, so the next run of each row touches this one of the other at a corner
+        if (diagonal)
+        {
+          if (i + 1 < above.size() && above[i + 1].id == row[j].id)
+            uf.unite(base_a + static_cast<uint>(i + 1), base_b + static_cast<uint>(j));
+
+          if (j + 1 < row.size() && above[i].id == row[j + 1].id)
+            uf.unite(base_a + static_cast<uint>(i), base_b + static_cast<uint>(j + 1));
+        }
+
+        ++i;
+        ++j;
+      }
+      else if (end_a < end_b)
+        ++i;
+      else
+        ++j;
+    }
+  };
+
+  const uint n_bands = parallel_bands(n_rows, [&](uint, uint y_begin, uint y_end)
+  {
+    for (uint k = offsets[y_begin]; k < offsets[y_end]; ++k)
+      uf[k].store(k, std::memory_order_relaxed);
+
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      const auto& row = map[y];
+
+      // (a SegmentMap's neighboring runs normally differ, but nothing forces builders to merge them)
+      for (uint i = 1; i < row.size(); ++i)
+        if (row[i - 1].id == row[i].id)
+          uf.unite(offsets[y] + i - 1, offsets[y] + i);
+
+      if (y > y_begin)
+        unite_rows(y);
+    }
+  }, 64);
+
+  /* boundary merge: the first row of every band but the first against the row above it */
+
+  if (n_bands > 1)
+  {
+    parallel_bands(n_bands - 1, [&](uint, uint b_begin, uint b_end)
+    {
+      for (uint b = b_begin + 1; b <= b_end; ++b)
+        unite_rows( static_cast<uint>( static_cast<unsigned long long>(n_rows) * b / n_bands ) );
+    });
+  }
+
+  /* flatten: number the roots in run order and accumulate each component's stats */
+
+  cl._M_labels.resize(n_runs);
+
+  for (uint y = 0; y < n_rows; ++y)
+  {
+    const auto& row = map[y];
+    uint start_x = 0;
+
+    for (uint i = 0; i < row.size(); ++i)
+    {
+      const uint k = offsets[y] + i;
+      const uint root = uf.find(k);
+      const uint x1 = start_x, x2 = row[i].end;
+      start_x = x2;
+
+      const bool on_edge = (y == 0 || y + 1 == n_rows || x1 == 0 || x2 == map.width());
+
+      if (root == k) // the first run of a new component (roots are their set's smallest run index)
+      {
+        cl._M_labels[k] = cl.n_components();
+        cl._M_components.push_back({ row[i].id, x1, x2, y, y + 1, x2 - x1, on_edge });
+        continue;
+      }
+
+      const uint c = cl._M_labels[k] = cl._M_labels[root];
+      auto& comp = cl._M_components[c];
+      comp.x1 = std::min(comp.x1, x1);
+      comp.x2 = std::max(comp.x2, x2);
+      comp.y2 = y + 1;
+      comp.area += x2 - x1;
+      comp.touches_edge |= on_edge;
+    }
+  }
+
+  /* group components by entity (CSR) */
+
+  std::vector< std::pair<EntityT, uint> > by_id;
+  by_id.reserve(cl.n_components());
+
+  for (uint c = 0; c < cl.n_components(); ++c)
+    by_id.emplace_back(cl._M_components[c].id, c);
+
+  std::sort(by_id.begin(), by_id.end());
+
+  cl._M_by_id.reserve(by_id.size());
+  cl._M_id_offsets.push_back(0);
+
+  for (size_t i = 0; i < by_id.size(); ++i)
+  {
+    if (i > 0 && by_id[i].first != by_id[i - 1].first)
+      cl._M_id_offsets.push_back( static_cast<uint>(i) );
+
+    if (i == 0 || by_id[i].first != by_id[i - 1].first)
+      cl._M_ids.push_back(by_id[i].first);
+
+    cl._M_by_id.push_back(by_id[i].second);
+  }
+
+  cl._M_id_offsets.push_back( static_cast<uint>(by_id.size()) );
+  cl._M_id_offsets.push_back( static_cast<uint>(by_id.size()) ); // (empty range for absent IDs)
+  return cl;
+}
+
+
+#endif
@@ -0,0 +1,305 @@
+#include "DistanceTransform.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "Error.h"
+#include "parallel.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+namespace {
+
+constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+
+
+// First pass: into `ny`, the row of the nearest feature in each pixel's column (NONE if the column has none). Each
+// band of columns is swept down & then up a row at a time.
+template<typename IsFeature>
+void nearest_in_columns(uint width, uint height, const IsFeature& is_feature, uint32_t* ny)
+{
+  parallel_bands(width, [&](uint, uint x_begin, uint x_end)
+  {
+    for (uint y = 0; y < height; ++y)
+    {
+      uint32_t* p_row = ny + size_t(width) * y;
+      const uint32_t* p_above = (y > 0) ? p_row - width : nullptr;
+
+      for (uint x = x_begin; x < x_end; ++x)
+        p_row[x] = is_feature(x, y) ? y : p_above ? p_above[x] : NONE;
+    }
+
+    for (uint y = height - 1; y-- > 0; )
+    {
+      uint32_t* p_row = ny + size_t(width) * y;
+      const uint32_t* p_below = p_row + width;
+
+      for (uint x = x_begin; x < x_end; ++x)
+      {
+        // (the one below is either at or below y + 1, or the same as ours)
+        const uint32_t below = p_below[x];
+
+        if (below != NONE && (p_row[x] == NONE || below - y < y - p_row[x]))
+          p_row[x] = below;
+      }
+    }
+  }, 64);
+}
+
+
+// Second pass: each row's squared distances are the lower envelope of the parabolas (x - q)^2 + f(q), where f(q) is
+// the squared distance to the nearest feature in column q. Overwrites `ny` with the squared distances (saturated
+// at NONE - 1) and calls on_nearest(x, y, feature_x, feature_y) for each pixel.
+template<typename OnNearest>
+void lower_envelopes(uint width, uint height, uint32_t* ny, const OnNearest& on_nearest)
+{
+  parallel_bands(height, [&](uint, uint y_begin, uint y_end)
+  {
+    std::vector<uint32_t> feature_y(width);
+    std::vector<uint>     v(width);     // columns of the parabolas in the envelope
+    std::vector<double>   z(width + 1); // z[k]..z[k+1]: where parabola k is the lowest
+
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      uint32_t* p_row = ny + size_t(width) * y;
+      memcpy(feature_y.data(), p_row, width * sizeof(uint32_t));
+
+      auto f = [&](uint q) { const int64_t dy = int64_t(y) - feature_y[q]; return dy * dy; };
+
+      int k = -1;
+
+      for (uint q = 0; q < width; ++q)
+      {
+        if (feature_y[q] == NONE)
+          continue;
+
+        if (k < 0)
+        {
+          k = 0;
+          v[0] = q;
+          z[0] = -std::numeric_limits<double>::infinity();
+          z[1] = std::numeric_limits<double>::infinity();
+          continue;
+        }
+
+        // Intersection with the envelope's last parabola; the ones it hides are popped
+        const int64_t fq = f(q) + int64_t(q) * q;
+        double s;
+
+        for (;;)
+        {
+          const uint p = v[k];
+          s = double(fq - (f(p) + int64_t(p) * p)) / (2.0 * (double(q) - double(p)));
+
+          if (s > z[k] || k == 0)
+            break;
+
+          --k;
+        }
+
+        ++k;
+        v[k] = q;
+        z[k] = s;
+        z[k + 1] = std::numeric_limits<double>::infinity();
+      }
+
+      if (k < 0) // (no features anywhere)
+      {
+        std::fill_n(p_row, width, NONE);
+        continue;
+      }
+
+      k = 0;
+
+      for (uint x = 0; x < width; ++x)
+      {
+        while (z[k + 1] < double(x))
+          ++k;
+
+        const uint q = v[k];
+        const int64_t dx = int64_t(x) - q;
+        p_row[x] = static_cast<uint32_t>( std::min<int64_t>(dx * dx + f(q), NONE - 1) );
+        on_nearest(x, y, q, feature_y[q]);
+      }
+    }
+  }, 16);
+}
+
+
+template<typename IsFeature, typename OnNearest>
+DistanceField distance_transform(uint width, uint height, const IsFeature& is_feature, const OnNearest& on_nearest)
+{
+  DistanceField df(width, height);
+
+  if (width > 0 && height > 0)
+  {
+    nearest_in_columns(width, height, is_feature, df.row(0));
+    lower_envelopes(width, height, df.row(0), on_nearest);
+  }
+
+  return df;
+}
+
+}
+
+
+DistanceField border_distances(const IdRaster& r)
+{
+  const uint width = r.width(), height = r.height();
+
+  auto is_border = [&](uint x, uint y)
+  {
+    const prov_id_t* p = r.row(y) + x;
+    const prov_id_t id = *p;
+
+    return (x > 0 && p[-1] != id) || (x + 1 < width && p[1] != id) ||
+           (y > 0 && r.row(y - 1)[x] != id) || (y + 1 < height && r.row(y + 1)[x] != id);
+  };
+
+  return distance_transform(width, height, is_border, [](uint, uint, uint, uint) {});
+}
+
+
+DistanceField propagate_labels(IdRaster& r, const std::vector<uint8_t>& assigned)
+{
+  const uint width = r.width(), height = r.height();
+  assert(assigned.size() == size_t(width) * height);
+
+  auto is_assigned = [&](uint x, uint y) { return assigned[size_t(width) * y + x] != 0; };
+
+  // (assigned pixels are never written, so rows may read each other's freely)
+  return distance_transform(width, height, is_assigned, [&](uint x, uint y, uint fx, uint fy)
+  {
+    if (fx != x || fy != y)
+      r.row(y)[x] = r.row(fy)[fx];
+  });
+}
+
+
+IdRaster scale_sdf(const IdRaster& src, uint out_width, uint out_height, std::pmr::memory_resource* mr)
+{
+  const uint width = src.width(), height = src.height();
+
+  if (width == 0 || height == 0)
+    throw Error("Can't scale an empty map");
+
+  // Unsigned distance from each pixel's center to its province's border, which runs along the outer edges of the
+  // border pixels (so it's 1/2 for them)
+  std::vector<float> dist(size_t(width) * height);
+  {
+    const auto df = border_distances(src);
+
+    parallel_bands(height, [&](uint, uint y_begin, uint y_end)
+    {
+      for (uint y = y_begin; y < y_end; ++y)
+        for (uint x = 0; x < width; ++x)
+          dist[size_t(width) * y + x] = (df.d2(x, y) == DistanceField::NO_FEATURE)
+                                        ? float(width + height) : df.distance(x, y) + 0.5f;
+    }, 16);
+  }
+
+  // Source sample positions of the output pixels' centers: the pixel before, the one after, & the weight of the
+  // latter
+  struct Sample
+  {
+    uint  i0, i1;
+    float t;
+  };
+
+  auto samples = [](uint n_src, uint n_out)
+  {
+    std::vector<Sample> s(n_out);
+
+    for (uint o = 0; o < n_out; ++o)
+    {
+      const double q = (o + 0.5) * n_src / n_out - 0.5;
+      const double q0 = std::clamp(std::floor(q), 0.0, double(n_src - 1));
+      const uint i0 = static_cast<uint>(q0);
+      s[o] = { i0, std::min(i0 + 1, n_src - 1), static_cast<float>( std::clamp(q - q0, 0.0, 1.0) ) };
+    }
+
+    return s;
+  };
+
+  const auto xs = samples(width, out_width), ys = samples(height, out_height);
+
+  IdRaster out(out_width, out_height, mr);
+  std::vector< std::vector<size_t> > band_unclaimed( max_bands(out_height, 16) );
+
+  const uint n_bands = parallel_bands(out_height, [&](uint band, uint y_begin, uint y_end)
+  {
+    for (uint oy = y_begin; oy < y_end; ++oy)
+    {
+      const auto& sy = ys[oy];
+      const prov_id_t* row0 = src.row(sy.i0);
+      const prov_id_t* row1 = src.row(sy.i1);
+      const float* dist0 = dist.data() + size_t(width) * sy.i0;
+      const float* dist1 = dist.data() + size_t(width) * sy.i1;
+      prov_id_t* p_out = out.row(oy);
+
+      for (uint ox = 0; ox < out_width; ++ox)
+      {
+        const auto& sx = xs[ox];
+        const prov_id_t ids[4] = { row0[sx.i0], row0[sx.i1], row1[sx.i0], row1[sx.i1] };
+
+        if (ids[0] == ids[1] && ids[0] == ids[2] && ids[0] == ids[3])
+        {
+          p_out[ox] = ids[0];
+          continue;
+        }
+
+        const float d[4] = { dist0[sx.i0], dist0[sx.i1], dist1[sx.i0], dist1[sx.i1] };
+        const float w[4] = { (1 - sx.t) * (1 - sy.t), sx.t * (1 - sy.t), (1 - sx.t) * sy.t, sx.t * sy.t };
+
+        prov_id_t best_id = ids[0];
+        float best_sdf = std::numeric_limits<float>::infinity();
+
+        for (int c = 0; c < 4; ++c)
+        {
+          if (c > 0 && (ids[c] == ids[0] || (c > 1 && ids[c] == ids[1]) || (c > 2 && ids[c] == ids[2])))
+            continue; // (seen it)
+
+          float sdf = 0;
+
+          for (int i = 0; i < 4; ++i)
+            sdf += w[i] * ((ids[i] == ids[c]) ? -d[i] : d[i]);
+
+          if (sdf < best_sdf)
+          {
+            best_sdf = sdf;
+            best_id = ids[c];
+          }
+        }
+
+        p_out[ox] = best_id;
+
+        if (best_sdf > 0)
+          band_unclaimed[band].push_back(size_t(out_width) * oy + ox);
+      }
+    }
+  }, 16);
+
+  size_t n_unclaimed = 0;
+
+  for (uint band = 0; band < n_bands; ++band)
+    n_unclaimed += band_unclaimed[band].size();
+
+  if (n_unclaimed > 0)
+  {
+    std::vector<uint8_t> assigned(size_t(out_width) * out_height, 1);
+
+    for (uint band = 0; band < n_bands; ++band)
+      for (size_t i : band_unclaimed[band])
+        assigned[i] = 0;
+
+    propagate_labels(out, assigned);
+  }
+
+  return out;
+}
+
+
+//NAMESPACE_CK2_END;
@@ -0,0 +1,67 @@
+#ifndef MAPSCALER_DISTANCE_TRANSFORM_H
+#define MAPSCALER_DISTANCE_TRANSFORM_H
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <memory_resource>
+#include <vector>
+
+#include "IdRaster.h"
+#include "common.h"
+
+
+// Exact Euclidean distance transforms over ID rasters (Felzenszwalb & Huttenlocher's separable algorithm): a sweep
+// down & up the columns finds each pixel's nearest feature within its column, and then each row's distances are
+// the lower envelope of the parabolas rooted at those, which is found in linear time. Both passes are parallel,
+// the first by bands of columns and the second by bands of rows, and both access memory row by row.
+
+struct DistanceField
+{
+  static constexpr uint32_t NO_FEATURE = std::numeric_limits<uint32_t>::max(); // (there were no features at all)
+
+  DistanceField(uint width_, uint height_) : _M_width(width_), _M_height(height_), _M_d2(size_t(width_) * height_) {}
+
+  auto width()  const noexcept { return _M_width; }
+  auto height() const noexcept { return _M_height; }
+
+  uint32_t*       row(uint y) noexcept       { return _M_d2.data() + size_t(_M_width) * y; }
+  const uint32_t* row(uint y) const noexcept { return _M_d2.data() + size_t(_M_width) * y; }
+
+  // Squared distance from pixel (x, y) to the nearest feature pixel, in pixels
+  uint32_t d2(uint x, uint y) const noexcept { return row(y)[x]; }
+
+  float distance(uint x, uint y) const noexcept
+  {
+    const uint32_t d = d2(x, y);
+    return (d == NO_FEATURE) ? std::numeric_limits<float>::infinity() : std::sqrt(float(d));
+  }
+
+private:
+  uint                  _M_width;
+  uint                  _M_height;
+  std::vector<uint32_t> _M_d2;
+};
+
+
+// Distances to the nearest border pixel, i.e. a pixel with a 4-neighbor of another ID (the map's edges aren't
+// borders)
+DistanceField border_distances(const IdRaster&);
+
+// Label propagation: give every pixel which isn't `assigned` (one flag per pixel, row-major) the ID of the nearest
+// assigned pixel. Returns the distances to those.
+DistanceField propagate_labels(IdRaster&, const std::vector<uint8_t>& assigned);
+
+
+// Signed-distance-field scaling to out_width x out_height (normally, an upscale). Each province's signed distance
+// to its border (negative inside) is sampled bilinearly at every output pixel's center, and the pixel goes to the
+// province whose distance is the lowest there, so borders follow the zero crossings: straight & diagonal borders
+// come out smooth instead of as staircases, while corners are rounded off slightly. Pixels which no province
+// claims (e.g., at the centers of junctions of four) are then given the nearest province by label propagation.
+//
+// Only the IDs of a pixel's four nearest source pixels are ever considered, so no new IDs appear.
+IdRaster scale_sdf(const IdRaster&, uint out_width, uint out_height,
+                   std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+
+#endif
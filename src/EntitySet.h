@@ -0,0 +1,96 @@
+#ifndef MAPSCALER_ENTITY_SET_H
+#define MAPSCALER_ENTITY_SET_H
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+
+#include "common.h"
+
+
+// The distinct entity IDs seen during a sweep over a map, for collecting its vertex set in time linear in the
+// number of segments rather than by sorting one ID per segment. IDs of up to 16 bits (such as prov_id_t) go into a
+// presence bitmap over the whole ID space (8 KiB), which also yields them in order for free; wider IDs go into a
+// hash set, and only the distinct ones are sorted at the end.
+
+template<typename EntityT>
+struct EntitySet
+{
+  static_assert(std::is_integral_v<EntityT>, "Entity IDs are integers");
+
+  static constexpr bool DENSE = sizeof(EntityT) <= 2;
+
+  EntitySet()
+  {
+    if constexpr (DENSE)
+      _M_bits.assign(N_WORDS, 0);
+  }
+
+  void insert(EntityT id)
+  {
+    if constexpr (DENSE)
+    {
+      const auto i = index(id);
+      _M_bits[i / 64] |= uint64_t(1) << (i % 64);
+    }
+    else
+      _M_hashed.insert(id);
+  }
+
+  void merge(const EntitySet& other)
+  {
+    if constexpr (DENSE)
+    {
+      for (size_t w = 0; w < N_WORDS; ++w)
+        _M_bits[w] |= other._M_bits[w];
+    }
+    else
+      _M_hashed.insert(other._M_hashed.begin(), other._M_hashed.end());
+  }
+
+  // The IDs, ascending
+  std::vector<EntityT> sorted() const
+  {
+    std::vector<EntityT> ids;
+
+    if constexpr (DENSE)
+    {
+      for (size_t w = 0; w < N_WORDS; ++w)
+      {
+        for (uint64_t bits = _M_bits[w]; bits != 0; bits &= bits - 1)
+        {
+          const size_t i = w * 64 + static_cast<size_t>(__builtin_ctzll(bits));
+          ids.push_back( static_cast<EntityT>( static_cast<Index>(i) ) );
+        }
+      }
+
+      // (signed IDs: the negative ones were indexed after the non-negative ones)
+      if constexpr (std::is_signed_v<EntityT>)
+        std::rotate(ids.begin(), std::find_if(ids.begin(), ids.end(), [](EntityT id) { return id < 0; }),
+                    ids.end());
+    }
+    else
+    {
+      ids.assign(_M_hashed.begin(), _M_hashed.end());
+      std::sort(ids.begin(), ids.end());
+    }
+
+    return ids;
+  }
+
+private:
+  using Index = std::make_unsigned_t<EntityT>;
+
+  static constexpr size_t N_WORDS = DENSE ? (size_t(std::numeric_limits<Index>::max()) + 1 + 63) / 64 : 0;
+
+  static size_t index(EntityT id) noexcept { return static_cast<Index>(id); }
+
+  std::vector<uint64_t>       _M_bits;   // DENSE
+  std::unordered_set<EntityT> _M_hashed; // otherwise
+};
+
+
+#endif
@@ -0,0 +1,120 @@
+#include "IdRaster.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "ProvinceSegmenter.h"
+#include "kernels.h"
+#include "parallel.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+void to_id_raster(const ProvSegmentMap& map, IdRaster& raster)
+{
+  assert(map.width() == raster.width() && map.height() == raster.height());
+
+  parallel_bands(map.height(), [&](uint, uint y_begin, uint y_end)
+  {
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      prov_id_t* p_row = raster.row(y);
+
+      if (y > y_begin && map.same_row(y, y - 1))
+      {
+        memcpy(p_row, raster.row(y - 1), raster.width() * sizeof(prov_id_t));
+        continue;
+      }
+
+      uint x = 0;
+
+      for (const auto& seg : map[y])
+      {
+        std::fill(p_row + x, p_row + seg.end, seg.id);
+        x = seg.end;
+      }
+    }
+  }, 16);
+}
+
+
+void to_segment_map(const IdRaster& raster, ProvSegmentMap& map)
+{
+  assert(map.width() == raster.width() && map.height() == raster.height());
+
+  const uint width = raster.width();
+
+  parallel_bands(raster.height(), [&](uint, uint y_begin, uint y_end)
+  {
+    const auto& k = kernels();
+
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      const prov_id_t* p_row = raster.row(y);
+
+      // An identical row is cheaper to spot with a memcmp than by segmenting it first
+      if (y > y_begin && memcmp(p_row, raster.row(y - 1), width * sizeof(prov_id_t)) == 0)
+      {
+        map.share_row(y, y - 1);
+        continue;
+      }
+
+      auto& row = map.mutable_row(y);
+      row.clear();
+
+      for (uint x = 0; x < width; )
+      {
+        const uint end_x = k.run_end_id16(p_row, x, width);
+        row.emplace_back(p_row[x], static_cast<ProvSegmentMap::coord_type>(end_x));
+        x = end_x;
+      }
+    }
+  }, 16);
+}
+
+
+void read_id_raster(const BMPReader& bmp, const ColorIndex& color_idx, IdRaster& raster)
+{
+  assert(bmp.width() == raster.width() && bmp.height() == raster.height());
+
+  const uint height = bmp.height();
+
+  if (height == 0)
+    return;
+
+  // (an RLE band has to decode everything before it, so splitting one up would only multiply that work)
+  parallel_bands(height, [&](uint, uint y_begin, uint y_end)
+  {
+    auto row_sink = [&](span<const BMPReader::RowSegment> segs, uint y)
+    {
+      prov_id_t* p_row = raster.row(y);
+
+      // Consecutive segments of a row alternate between few colors, so it pays to remember the last lookup
+      BGR last_color = segs[0].color;
+      const prov_id_t* p_id = color_idx.find(last_color);
+      uint x = 0;
+
+      for (size_t i = 0; i < segs.size(); ++i)
+      {
+        if (segs[i].color != last_color)
+        {
+          last_color = segs[i].color;
+          p_id = color_idx.find(last_color);
+        }
+
+        if (!p_id)
+          throw_stray_color(bmp, segs, i, y);
+
+        std::fill(p_row + x, p_row + segs[i].end, *p_id);
+        x = segs[i].end;
+      }
+    };
+
+    bmp.foreach_row_segments(row_sink, bmp.first_row_of(y_begin, y_end), y_end - y_begin);
+  }, bmp.is_rle() ? height : 64);
+}
+
+
+//NAMESPACE_CK2_END;
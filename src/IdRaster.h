@@ -0,0 +1,111 @@
+#ifndef MAPSCALER_ID_RASTER_H
+#define MAPSCALER_ID_RASTER_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory_resource>
+#include <utility>
+
+#include "BMPReader.h"
+#include "ColorIndex.h"
+#include "SegmentMap.h"
+#include <ck2/common.h>
+#include "common.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2; // until it is actually in the lib
+
+
+// Dense raster of province IDs, one 16-bit ID per pixel: the secondary representation, for the operations which
+// are naturally 2D and awkward on run-length rows (neighborhood filters, pixel-art scalers). It's 2/3 the size of
+// the BGR bitmap, and every row starts on a 64-byte boundary and is padded to a whole number of 64-byte lines, so
+// neighborhood kernels can run over rows with aligned vector loads & stores and never straddle a cache line.
+//
+// Pixels are uninitialized upon construction (the conversions below overwrite all of them), and the padding at
+// the end of each row is never read by anything here, so kernels may use it as scratch.
+//
+// Storage comes from `mr`, as with SegmentMap.
+
+struct IdRaster
+{
+  static constexpr size_t ALIGNMENT = 64; // bytes
+  static constexpr uint   ALIGNMENT_PIXELS = static_cast<uint>(ALIGNMENT / sizeof(prov_id_t));
+
+  IdRaster(uint width_, uint height_, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+  : _M_width(width_)
+  , _M_height(height_)
+  , _M_stride( (width_ + ALIGNMENT_PIXELS - 1) / ALIGNMENT_PIXELS * ALIGNMENT_PIXELS )
+  , _M_data(nullptr)
+  , _M_mr(mr)
+  {
+    if (size_bytes() > 0)
+      _M_data = static_cast<prov_id_t*>( _M_mr->allocate(size_bytes(), ALIGNMENT) );
+  }
+
+  ~IdRaster()
+  {
+    if (_M_data)
+      _M_mr->deallocate(_M_data, size_bytes(), ALIGNMENT);
+  }
+
+  IdRaster(const IdRaster&) = delete;
+  IdRaster& operator=(const IdRaster&) = delete;
+
+  IdRaster(IdRaster&& o) noexcept
+  : _M_width(o._M_width)
+  , _M_height(o._M_height)
+  , _M_stride(o._M_stride)
+  , _M_data(std::exchange(o._M_data, nullptr))
+  , _M_mr(o._M_mr)
+  {}
+
+  IdRaster& operator=(IdRaster&& o) noexcept
+  {
+    std::swap(_M_width, o._M_width);
+    std::swap(_M_height, o._M_height);
+    std::swap(_M_stride, o._M_stride);
+    std::swap(_M_data, o._M_data);
+    std::swap(_M_mr, o._M_mr);
+    return *this;
+  }
+
+  auto width()    const noexcept { return _M_width; }
+  auto height()   const noexcept { return _M_height; }
+  auto stride()   const noexcept { return _M_stride; } // pixels from the start of one row to that of the next
+  auto resource() const noexcept { return _M_mr; }
+
+  size_t size_bytes() const noexcept { return size_t(_M_stride) * _M_height * sizeof(prov_id_t); }
+
+  prov_id_t*       row(uint y) noexcept       { assert(y < _M_height); return _M_data + size_t(_M_stride) * y; }
+  const prov_id_t* row(uint y) const noexcept { assert(y < _M_height); return _M_data + size_t(_M_stride) * y; }
+
+  prov_id_t& id_at(uint x, uint y) noexcept       { assert(x < _M_width); return row(y)[x]; }
+  prov_id_t  id_at(uint x, uint y) const noexcept { assert(x < _M_width); return row(y)[x]; }
+
+private:
+  uint                       _M_width;
+  uint                       _M_height;
+  uint                       _M_stride;
+  prov_id_t*                 _M_data;
+  std::pmr::memory_resource* _M_mr;
+};
+
+
+// The conversions all run in parallel bands of rows and require the raster & map to have the same dimensions.
+
+// Paint `map` into `raster`. Rows shared with the row above are copied rather than painted again.
+void to_id_raster(const ProvSegmentMap& map, IdRaster& raster);
+
+// Segment `raster` into `map`, sharing identical consecutive rows. (Rows are built concurrently, so the map's
+// memory resource must be thread-safe.)
+void to_segment_map(const IdRaster& raster, ProvSegmentMap& map);
+
+// Read the provinces bitmap straight into `raster`, resolving colors to province IDs. Throws upon the first stray
+// color, like segment_provinces(). (RLE bitmaps are read in a single band; see BMPReader.)
+void read_id_raster(const BMPReader&, const ColorIndex&, IdRaster& raster);
+
+
+//NAMESPACE_CK2_END;
+#endif
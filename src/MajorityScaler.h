@@ -0,0 +1,271 @@
+#ifndef MAPSCALER_MAJORITY_SCALER_H
+#define MAPSCALER_MAJORITY_SCALER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "ProvinceIndex.h"
+#include "SegmentMap.h"
+#include "common.h"
+#include "parallel.h"
+
+
+// Area-majority scaling of a SegmentMap, for downscaling (previews, lower-resolution layers like trees.bmp): every
+// output pixel goes to the entity covering the most of its area in the source (ties to the lowest ID), measured
+// exactly. Unlike nearest-neighbor sampling, this never lets a sliver win a pixel by the luck of where a sample
+// falls, but small & thin entities can still lose every pixel to their neighbors; those are then forced back in at
+// the output pixel they cover the most, found through the source's ProvinceIndex, without taking the last pixel of
+// another entity.
+//
+// Each output row is swept across the segment boundaries of the source rows it covers, and a stretch of output
+// pixels lying wholly between two boundaries is resolved at once, so the cost is O(segments) plus O(runs) of the
+// entities which had to be forced, not O(pixels).
+
+template<typename EntityT>
+struct Survival
+{
+  std::vector<EntityT> forced; // entities which lost all of their pixels and were forced back in, ascending
+  std::vector<EntityT> lost;   // entities which couldn't be, since every pixel about them was another's last one
+};
+
+
+// Scale `src` into `out`, whose dimensions must be set already (and whose rows are overwritten). Bands of output
+// rows are built in parallel, so `out`'s memory resource must be thread-safe.
+template<typename EntityT, typename CoordT>
+Survival<EntityT> scale_majority(const SegmentMap<EntityT, CoordT>& src, SegmentMap<EntityT, CoordT>& out)
+{
+  // Lengths are in units which divide both source & output pixels: a source pixel is out_width units wide (and
+  // out_height high), an output pixel is width units wide (and height high).
+  const uint64_t width = src.width(), height = src.height();
+  const uint64_t out_width = out.width(), out_height = out.height();
+  const uint64_t total_width = width * out_width;
+
+  Survival<EntityT> survival;
+
+  if (width == 0 || height == 0 || out_width == 0 || out_height == 0)
+    return survival;
+
+  const auto idx = build_province_index(src);
+  const uint n_vertices = idx.n_vertices();
+
+  struct Share
+  {
+    EntityT  id;
+    uint64_t area;
+  };
+
+  auto add_share = [](std::vector<Share>& shares, EntityT id, uint64_t area)
+  {
+    auto it = std::find_if(shares.begin(), shares.end(), [&](const Share& s) { return s.id == id; });
+
+    if (it != shares.end())
+      it->area += area;
+    else
+      shares.push_back({ id, area });
+  };
+
+  auto majority = [](const std::vector<Share>& shares)
+  {
+    const Share* p_best = &shares.front();
+
+    for (const auto& s : shares)
+      if (s.area > p_best->area || (s.area == p_best->area && s.id < p_best->id))
+        p_best = &s;
+
+    return p_best->id;
+  };
+
+  std::vector< std::vector<uint64_t> > band_pixels( max_bands(out.height(), 16) ); // per vertex
+
+  const uint n_bands = parallel_bands(out.height(), [&](uint band, uint oy_begin, uint oy_end)
+  {
+    auto& n_pixels = band_pixels[band];
+    n_pixels.assign(n_vertices, 0);
+
+    // A source row covering the output row, with the height it covers of it & a cursor into its segments
+    struct Cursor
+    {
+      const typename SegmentMap<EntityT, CoordT>::Row* p_row;
+      size_t   i;
+      uint64_t height;
+    };
+
+    std::vector<Cursor> rows;
+    std::vector<Share> column, stretch; // shares of the current output pixel; of the stretch between boundaries
+
+    for (uint oy = oy_begin; oy < oy_end; ++oy)
+    {
+      const uint64_t top = oy * height, bottom = (oy + 1) * height;
+      rows.clear();
+
+      for (uint64_t y = top / out_height; y * out_height < bottom; ++y)
+      {
+        const uint64_t h = std::min(bottom, (y + 1) * out_height) - std::max(top, y * out_height);
+
+        // (identical rows count as one)
+        if (!rows.empty() && src.same_row(uint(y), uint(y) - 1))
+          rows.back().height += h;
+        else
+          rows.push_back({ &src[uint(y)], 0, h });
+      }
+
+      auto& row = out.mutable_row(oy);
+      row.clear();
+
+      auto emit = [&](EntityT id, uint64_t end)
+      {
+        if (!row.empty() && row.back().id == id)
+          row.back().end = static_cast<CoordT>(end);
+        else
+          row.emplace_back(id, static_cast<CoordT>(end));
+      };
+
+      uint64_t x = 0, ox = 0;
+
+      while (x < total_width)
+      {
+        // The next boundary in any of the rows, and the shares of the stretch [x, boundary) per unit of length
+        uint64_t boundary = total_width;
+        stretch.clear();
+
+        for (const auto& c : rows)
+        {
+          const auto& seg = (*c.p_row)[c.i];
+          boundary = std::min(boundary, uint64_t(seg.end) * out_width);
+          add_share(stretch, seg.id, c.height);
+        }
+
+        while (x < boundary)
+        {
+          const uint64_t column_end = (ox + 1) * width;
+
+          if (x == ox * width && boundary >= column_end)
+          {
+            // Whole output pixels within the stretch
+            const uint64_t n = (boundary - x) / width;
+            emit(majority(stretch), ox + n);
+            ox += n;
+            x += n * width;
+            continue;
+          }
+
+          const uint64_t end = std::min(boundary, column_end);
+
+          for (const auto& s : stretch)
+            add_share(column, s.id, s.area * (end - x));
+
+          x = end;
+
+          if (x == column_end)
+          {
+            emit(majority(column), ++ox);
+            column.clear();
+          }
+        }
+
+        for (auto& c : rows)
+          if (uint64_t((*c.p_row)[c.i].end) * out_width == boundary)
+            ++c.i;
+      }
+
+      uint start_x = 0;
+
+      for (const auto& seg : row)
+      {
+        n_pixels[ idx.vertex(seg.id) ] += seg.end - start_x;
+        start_x = seg.end;
+      }
+
+      if (oy > oy_begin)
+        out.dedup_row(oy, oy - 1);
+    }
+  }, 16);
+
+  /* force in the entities which lost every pixel */
+
+  std::vector<uint64_t> n_pixels(n_vertices, 0);
+
+  for (uint band = 0; band < n_bands; ++band)
+    for (uint v = 0; v < n_vertices; ++v)
+      n_pixels[v] += band_pixels[band][v];
+
+  // (output pixel, area of it covered)
+  std::vector< std::pair<uint64_t, uint64_t> > coverage;
+
+  for (uint v = 0; v < n_vertices; ++v)
+  {
+    if (n_pixels[v] > 0)
+      continue;
+
+    coverage.clear();
+
+    for (const auto& r : idx.runs_of_vertex(v))
+    {
+      const uint64_t top = r.y * out_height, bottom = (r.y + 1) * out_height;
+      const uint64_t left = r.start * out_width, right = r.end * out_width;
+
+      for (uint64_t oy = top / height; oy * height < bottom; ++oy)
+      {
+        const uint64_t h = std::min(bottom, (oy + 1) * height) - std::max(top, oy * height);
+
+        for (uint64_t ox = left / width; ox * width < right; ++ox)
+        {
+          const uint64_t w = std::min(right, (ox + 1) * width) - std::max(left, ox * width);
+          coverage.emplace_back(oy * out_width + ox, w * h);
+        }
+      }
+    }
+
+    std::sort(coverage.begin(), coverage.end());
+    size_t n = 0;
+
+    for (size_t i = 0; i < coverage.size(); ++i)
+    {
+      if (n > 0 && coverage[n - 1].first == coverage[i].first)
+        coverage[n - 1].second += coverage[i].second;
+      else
+        coverage[n++] = coverage[i];
+    }
+
+    coverage.resize(n);
+    std::stable_sort(coverage.begin(), coverage.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+    // The most covered pixel whose owner can spare it; failing all of those, a neighbor of the most covered one
+    const uint64_t best = coverage.front().first;
+    const int around[8][2] = { {1, 0}, {-1, 0}, {0, 1}, {0, -1}, {1, 1}, {-1, 1}, {1, -1}, {-1, -1} };
+
+    for (const auto& d : around)
+    {
+      const int64_t x = int64_t(best % out_width) + d[0], y = int64_t(best / out_width) + d[1];
+
+      if (x >= 0 && y >= 0 && uint64_t(x) < out_width && uint64_t(y) < out_height)
+        coverage.emplace_back(uint64_t(y) * out_width + uint64_t(x), 0);
+    }
+
+    bool placed = false;
+
+    for (const auto& [pixel, area] : coverage)
+    {
+      const uint ox = uint(pixel % out_width), oy = uint(pixel / out_width);
+      const uint owner_v = idx.vertex( out.id_at(ox, oy) );
+
+      if (n_pixels[owner_v] <= 1)
+        continue;
+
+      out.set_id_at(ox, oy, idx.id(v));
+      --n_pixels[owner_v];
+      n_pixels[v] = 1;
+      placed = true;
+      break;
+    }
+
+    (placed ? survival.forced : survival.lost).push_back(idx.id(v));
+  }
+
+  return survival;
+}
+
+
+#endif
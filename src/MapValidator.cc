@@ -0,0 +1,233 @@
+#include "MapValidator.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include "ConnectedComponents.h"
+#include "parallel.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+MapValidator::MapValidator(const BMPReader& bmp, const ColorIndex& color_idx, const DefinitionsTable& def_tbl)
+: _M_bmp(bmp)
+, _M_color_idx(color_idx)
+, _M_def_tbl(def_tbl)
+, _M_seg_map(bmp.width(), bmp.height(), &_M_arena) {}
+
+
+void MapValidator::run()
+{
+  scan();
+  find_islands_and_unused();
+  find_fragmented();
+}
+
+
+void MapValidator::scan()
+{
+  const uint n_rows = _M_bmp.height();
+  std::vector< std::vector<StrayRun> > band_runs( max_bands(n_rows, 64) );
+
+  parallel_bands(n_rows, [&](uint band, uint first_row, uint end_row)
+  {
+    auto& stray_runs = band_runs[band];
+    const uint band_first_y = _M_bmp.y_of(first_row);
+    const int  prev_dy = (_M_bmp.emits_top_down()) ? -1 : 1; // the row read just before any other in the band
+
+    // Neighboring segments very often share a color with one of their recent predecessors, but hashing is cheap
+    // enough relative to I/O that a one-entry cache is all we bother with.
+    BGR last_color;
+    const prov_id_t* p_last_id = _M_color_idx.find(last_color);
+
+    _M_bmp.foreach_row_segments(
+      [&](span<const BMPReader::RowSegment> segs, uint y)
+      {
+        auto& row = _M_seg_map.mutable_row(y);
+        row.reserve(segs.size());
+        uint start_x = 0;
+
+        for (const auto& seg : segs)
+        {
+          if (seg.color != last_color)
+          {
+            last_color = seg.color;
+            p_last_id = _M_color_idx.find(seg.color);
+          }
+
+          if (p_last_id)
+            row.emplace_back(*p_last_id, seg.end);
+          else
+          {
+            row.emplace_back(STRAY_ID, seg.end);
+            stray_runs.push_back({ seg.color, start_x, seg.end, y });
+          }
+
+          start_x = seg.end;
+        }
+
+        // Share identical consecutive rows, but only within this band (the row read before the band's first row is
+        // still being written by another thread).
+        if (y != band_first_y)
+          _M_seg_map.dedup_row(y, static_cast<uint>( static_cast<int>(y) + prev_dy ));
+      },
+      first_row, end_row - first_row
+    );
+  }, 64);
+
+  group_strays(band_runs);
+}
+
+
+void MapValidator::group_strays(std::vector< std::vector<StrayRun> >& band_runs)
+{
+  std::vector<StrayRun> runs;
+
+  for (auto& v : band_runs)
+    runs.insert(runs.end(), v.begin(), v.end());
+
+  // Order runs such that identical runs (same color, same extent) on consecutive rows end up adjacent, which
+  // makes merging them into rectangles a single linear pass.
+  auto key = [](const StrayRun& r)
+  {
+    return std::make_tuple(r.color.red(), r.color.green(), r.color.blue(), r.start_x, r.end_x, r.y);
+  };
+
+  std::sort(runs.begin(), runs.end(), [&](const auto& a, const auto& b) { return key(a) < key(b); });
+
+  for (const auto& r : runs)
+  {
+    if (!_M_strays.empty())
+    {
+      auto& last = _M_strays.back();
+
+      if (last.color == r.color && last.x1 == r.start_x && last.x2 == r.end_x && last.y2 == r.y)
+      {
+        ++last.y2;
+        continue;
+      }
+    }
+
+    _M_strays.push_back({ r.color, r.start_x, r.end_x, r.y, r.y + 1 });
+  }
+}
+
+
+void MapValidator::find_islands_and_unused()
+{
+  prov_id_t max_id = 0;
+
+  for (const auto& row : _M_def_tbl)
+    max_id = std::max(max_id, row.id);
+
+  const uint n_rows = _M_seg_map.height();
+  std::vector< std::vector<Island> > band_islands( max_bands(n_rows, 256) );
+  std::vector< std::vector<bool> > band_used( band_islands.size(), std::vector<bool>(max_id + 1u, false) );
+
+  parallel_bands(n_rows, [&](uint band, uint y_begin, uint y_end)
+  {
+    auto& islands = band_islands[band];
+    auto& used = band_used[band];
+
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      uint start_x = 0;
+
+      for (const auto& seg : _M_seg_map[y])
+      {
+        if (seg.id <= max_id)
+          used[seg.id] = true;
+
+        if (seg.end - start_x == 1 && seg.id != STRAY_ID &&
+            (y == 0 || _M_seg_map.id_at(start_x, y - 1) != seg.id) &&
+            (y == n_rows - 1 || _M_seg_map.id_at(start_x, y + 1) != seg.id))
+        {
+          islands.push_back({ seg.id, start_x, y });
+        }
+
+        start_x = seg.end;
+      }
+    }
+  }, 256);
+
+  for (auto& v : band_islands)
+    _M_islands.insert(_M_islands.end(), v.begin(), v.end());
+
+  for (const auto& row : _M_def_tbl)
+  {
+    bool used = std::any_of(band_used.begin(), band_used.end(), [&](const auto& v) { return v[row.id]; });
+
+    if (!used)
+      _M_unused.push_back(row.id);
+  }
+}
+
+
+void MapValidator::find_fragmented()
+{
+  const auto cl = label_components(_M_seg_map);
+
+  for (auto id : cl.fragmented())
+    if (id != STRAY_ID)
+      _M_fragmented.push_back({ id, cl.n_components(id) });
+}
+
+
+void MapValidator::print_report(FILE* f) const
+{
+  fmt::print(f, "Validation of {}: {} defect(s) found\n", _M_bmp.path().generic_string(), n_defects());
+
+  if (!_M_strays.empty())
+  {
+    fmt::print(f, "\nStray colors ({} regions):\n", _M_strays.size());
+
+    for (const auto& s : _M_strays)
+    {
+      const auto& c = s.color;
+
+      if (s.x2 - s.x1 == 1 && s.y2 - s.y1 == 1)
+        fmt::print(f, "  RGB({}, {}, {}) at pixel (x:{}, y:{})\n", c.red(), c.green(), c.blue(), s.x1, s.y1);
+      else
+        fmt::print(f, "  RGB({}, {}, {}) at pixels (x:{} to {}, y:{} to {})\n",
+                   c.red(), c.green(), c.blue(), s.x1, s.x2 - 1, s.y1, s.y2 - 1);
+    }
+  }
+
+  if (!duplicate_colors().empty())
+  {
+    fmt::print(f, "\nDuplicate definition colors:\n");
+
+    for (const auto& d : duplicate_colors())
+      fmt::print(f, "  RGB({}, {}, {}) is defined by both province #{} and #{}\n",
+                 d.color.red(), d.color.green(), d.color.blue(), d.id, d.dup_id);
+  }
+
+  if (!_M_unused.empty())
+  {
+    fmt::print(f, "\nUnused definitions (color not found in bitmap):\n");
+
+    for (auto id : _M_unused)
+      fmt::print(f, "  province #{}\n", id);
+  }
+
+  if (!_M_islands.empty())
+  {
+    fmt::print(f, "\n1-pixel islands:\n");
+
+    for (const auto& i : _M_islands)
+      fmt::print(f, "  province #{} at pixel (x:{}, y:{})\n", i.id, i.x, i.y);
+  }
+
+  if (!_M_fragmented.empty())
+  {
+    fmt::print(f, "\nProvinces in several disconnected regions (not counted as defects):\n");
+
+    for (const auto& fp : _M_fragmented)
+      fmt::print(f, "  province #{} ({} regions)\n", fp.id, fp.n_regions);
+  }
+}
+
+
+//NAMESPACE_CK2_END;
@@ -0,0 +1,102 @@
+#ifndef MAPSCALER_MAP_VALIDATOR_H
+#define MAPSCALER_MAP_VALIDATOR_H
+
+#include <cstdio>
+#include <vector>
+
+#include "Arena.h"
+#include "BMPReader.h"
+#include "ColorIndex.h"
+#include "SegmentMap.h"
+#include <ck2/Color.h>
+#include <ck2/DefinitionsTable.h>
+#include "common.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2; // until it is actually in the lib
+
+
+// Whole-map validation of a provinces bitmap which, unlike normal segmentation, doesn't stop at the first defect.
+// The bitmap is scanned once, in parallel bands of rows, and every defect found is collected into one report:
+//
+//   - stray colors (colors without a definition), grouped into rectangles of identical runs on consecutive rows
+//   - colors which are claimed by more than one definition
+//   - definitions whose color never occurs in the bitmap
+//   - 1-pixel islands (a pixel with no 4-neighbor of the same province)
+//
+// Provinces made up of several disconnected regions are listed as well, but aren't counted as defects, since
+// exclaves are often intentional.
+//
+// The segment map built along the way is kept, with stray pixels assigned to STRAY_ID, so a clean validation
+// doesn't have to be followed by another segmentation pass.
+
+struct MapValidator
+{
+  // Province ID 0 is never a valid province, so we can use it to mark stray pixels in the segment map.
+  static constexpr prov_id_t STRAY_ID = 0;
+
+  struct StrayRegion
+  {
+    BGR  color;
+    uint x1, x2; // [x1, x2)
+    uint y1, y2; // [y1, y2)
+  };
+
+  struct Island
+  {
+    prov_id_t id;
+    uint      x, y;
+  };
+
+  struct FragmentedProvince
+  {
+    prov_id_t id;
+    uint      n_regions;
+  };
+
+  MapValidator(const BMPReader&, const ColorIndex&, const DefinitionsTable&);
+
+  // Scan the bitmap and collect all defects.
+  void run();
+
+  auto& segment_map()        const noexcept { return _M_seg_map; }
+  auto& stray_regions()      const noexcept { return _M_strays; }
+  auto& duplicate_colors()   const noexcept { return _M_color_idx.duplicates(); }
+  auto& unused_definitions() const noexcept { return _M_unused; }
+  auto& islands()            const noexcept { return _M_islands; }
+  auto& fragmented()         const noexcept { return _M_fragmented; }
+
+  size_t n_defects() const noexcept
+  {
+    return _M_strays.size() + duplicate_colors().size() + _M_unused.size() + _M_islands.size();
+  }
+
+  void print_report(FILE* f = stderr) const;
+
+private:
+  struct StrayRun
+  {
+    BGR  color;
+    uint start_x, end_x, y;
+  };
+
+  void scan();
+  void group_strays(std::vector< std::vector<StrayRun> >& band_runs);
+  void find_islands_and_unused();
+  void find_fragmented();
+
+  const BMPReader&        _M_bmp;
+  const ColorIndex&       _M_color_idx;
+  const DefinitionsTable& _M_def_tbl;
+  Arena                   _M_arena; // for the segment map, whose rows are built by several threads at once
+  ProvSegmentMap          _M_seg_map;
+  std::vector<StrayRegion> _M_strays;
+  std::vector<prov_id_t>  _M_unused;
+  std::vector<Island>     _M_islands;
+  std::vector<FragmentedProvince> _M_fragmented;
+};
+
+
+//NAMESPACE_CK2_END;
+#endif
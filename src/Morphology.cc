@@ -0,0 +1,224 @@
+#include "Morphology.h"
+
+#include <cmath>
+
+
+namespace {
+
+using Run = RunMask::Run;
+
+
+// Runs of a row shrunk by r on either side, except where they touch the map's edges
+void shrink(span<const Run> row, uint r, uint width, std::vector<Run>& out)
+{
+  out.clear();
+
+  for (const auto& run : row)
+  {
+    const uint start = (run.start == 0) ? 0 : run.start + r;
+    const uint end = (run.end == width) ? width : (run.end > r ? run.end - r : 0);
+
+    if (start < end)
+      out.push_back({ start, end });
+  }
+}
+
+
+// Runs of a row grown by r on either side (clipped to the map), merged where they now touch
+void grow(span<const Run> row, uint r, uint width, std::vector<Run>& out)
+{
+  out.clear();
+
+  for (const auto& run : row)
+  {
+    const uint start = (run.start > r) ? run.start - r : 0;
+    const uint end = std::min(width, run.end + r);
+
+    if (!out.empty() && start <= out.back().end)
+      out.back().end = std::max(out.back().end, end);
+    else
+      out.push_back({ start, end });
+  }
+}
+
+
+void intersect(const std::vector<Run>& a, const std::vector<Run>& b, std::vector<Run>& out)
+{
+  out.clear();
+  size_t i = 0, j = 0;
+
+  while (i < a.size() && j < b.size())
+  {
+    const uint start = std::max(a[i].start, b[j].start), end = std::min(a[i].end, b[j].end);
+
+    if (start < end)
+      out.push_back({ start, end });
+
+    if (a[i].end < b[j].end) ++i; else ++j;
+  }
+}
+
+
+void unite(const std::vector<Run>& a, const std::vector<Run>& b, std::vector<Run>& out)
+{
+  out.clear();
+  size_t i = 0, j = 0;
+
+  while (i < a.size() || j < b.size())
+  {
+    const Run& r = (j == b.size() || (i < a.size() && a[i].start < b[j].start)) ? a[i++] : b[j++];
+
+    if (!out.empty() && r.start <= out.back().end)
+      out.back().end = std::max(out.back().end, r.end);
+    else
+      out.push_back(r);
+  }
+}
+
+
+// Drop empty leading & trailing rows
+RunMask trim(RunMask&& m)
+{
+  uint first = 0, last = m.n_rows();
+
+  while (first < last && m.offsets[first + 1] == m.offsets[first]) ++first;
+  while (last > first && m.offsets[last] == m.offsets[last - 1]) --last;
+
+  if (first == 0 && last == m.n_rows())
+    return std::move(m);
+
+  RunMask t(m.y_begin + first);
+  t.runs.assign(m.runs.begin() + m.offsets[first], m.runs.begin() + m.offsets[last]);
+  t.offsets.clear();
+
+  for (uint i = first; i <= last; ++i)
+    t.offsets.push_back(m.offsets[i] - m.offsets[first]);
+
+  return t;
+}
+
+}
+
+
+StructuringElement StructuringElement::box(uint rx, uint ry)
+{
+  return StructuringElement( std::vector<uint>(2 * ry + 1, rx) );
+}
+
+
+StructuringElement StructuringElement::diamond(uint r)
+{
+  std::vector<uint> hw(2 * r + 1);
+
+  for (uint i = 0; i <= 2 * r; ++i)
+    hw[i] = r - static_cast<uint>( std::abs(int(i) - int(r)) );
+
+  return StructuringElement(std::move(hw));
+}
+
+
+StructuringElement StructuringElement::disk(uint r)
+{
+  std::vector<uint> hw(2 * r + 1);
+
+  // (the pixels whose centers lie within r + 0.5 of the center, which keeps small disks from degenerating)
+  const double rr = (r + 0.5) * (r + 0.5);
+
+  for (uint i = 0; i <= 2 * r; ++i)
+  {
+    const double dy = double(int(i) - int(r));
+    hw[i] = static_cast<uint>( std::floor(std::sqrt(rr - dy * dy)) );
+  }
+
+  return StructuringElement(std::move(hw));
+}
+
+
+uint64_t RunMask::area() const noexcept
+{
+  uint64_t n = 0;
+
+  for (const auto& r : runs)
+    n += r.end - r.start;
+
+  return n;
+}
+
+
+// A pixel survives erosion iff the element, centered on it, lies within the mask. Rows of the element beyond the
+// map's top or bottom edge are ignored, like columns beyond its sides.
+RunMask erode(const RunMask& m, const StructuringElement& se, uint width, uint height)
+{
+  const int ry = int(se.ry());
+  RunMask out(m.y_begin);
+  std::vector<Run> acc, shrunk, tmp;
+
+  for (uint y = m.y_begin; y < m.y_end(); ++y)
+  {
+    shrink(m.row(y), se.half_width(0), width, acc);
+
+    for (int dy = -ry; dy <= ry && !acc.empty(); ++dy)
+    {
+      const int yy = int(y) + dy;
+
+      if (dy == 0 || yy < 0 || yy >= int(height))
+        continue;
+
+      shrink(m.row(uint(yy)), se.half_width(dy), width, shrunk);
+      intersect(acc, shrunk, tmp);
+      acc.swap(tmp);
+    }
+
+    out.add_row(acc);
+  }
+
+  return trim(std::move(out));
+}
+
+
+// A pixel is in the dilation iff the element, centered on it, overlaps the mask
+RunMask dilate(const RunMask& m, const StructuringElement& se, uint width, uint height)
+{
+  if (m.empty())
+    return RunMask();
+
+  const uint ry = se.ry();
+  const uint y_begin = (m.y_begin > ry) ? m.y_begin - ry : 0;
+  const uint y_end = std::min(height, m.y_end() + ry);
+
+  RunMask out(y_begin);
+  std::vector<Run> acc, grown, tmp;
+
+  for (uint y = y_begin; y < y_end; ++y)
+  {
+    acc.clear();
+
+    for (int dy = -int(ry); dy <= int(ry); ++dy)
+    {
+      const int yy = int(y) + dy;
+
+      if (yy < int(m.y_begin) || yy >= int(m.y_end()))
+        continue;
+
+      grow(m.row(uint(yy)), se.half_width(dy), width, grown);
+      unite(acc, grown, tmp);
+      acc.swap(tmp);
+    }
+
+    out.add_row(acc);
+  }
+
+  return trim(std::move(out));
+}
+
+
+RunMask open(const RunMask& m, const StructuringElement& se, uint width, uint height)
+{
+  return dilate(erode(m, se, width, height), se, width, height);
+}
+
+
+RunMask close(const RunMask& m, const StructuringElement& se, uint width, uint height)
+{
+  return erode(dilate(m, se, width, height), se, width, height);
+}
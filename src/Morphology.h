@@ -0,0 +1,249 @@
+#ifndef MAPSCALER_MORPHOLOGY_H
+#define MAPSCALER_MORPHOLOGY_H
+
+#include <algorithm>
+#include <memory_resource>
+#include <vector>
+
+#include "ProvinceIndex.h"
+#include "SegmentMap.h"
+#include "common.h"
+#include "parallel.h"
+
+
+// Mathematical morphology on run-length rows. A binary mask (one province, say) is a list of [start, end) runs
+// per row, and a structuring element is symmetric about its center with a half-width per row, so eroding a row is
+// shrinking runs and intersecting over the element's rows, and dilating is growing runs and uniting: every
+// operation costs O(runs * element height), independent of how many pixels the runs cover.
+//
+// The map's edges don't count as background: a mask touching an edge isn't eroded from that side.
+
+struct StructuringElement
+{
+  // half_widths[i] is the half-width of row dy = i - ry(); there must be an odd number of rows
+  explicit StructuringElement(std::vector<uint> half_widths_) : half_widths(std::move(half_widths_))
+  {
+    assert(half_widths.size() % 2 == 1);
+  }
+
+  uint ry() const noexcept { return static_cast<uint>(half_widths.size() / 2); }
+  uint half_width(int dy) const noexcept { return half_widths[ static_cast<size_t>(dy + int(ry())) ]; }
+
+  static StructuringElement box(uint rx, uint ry);
+  static StructuringElement diamond(uint r);
+  static StructuringElement disk(uint r);
+
+  std::vector<uint> half_widths;
+};
+
+
+// Binary mask of runs over the rows [y_begin, y_begin + n_rows())
+struct RunMask
+{
+  struct Run
+  {
+    uint start, end; // [start, end)
+  };
+
+  RunMask(uint y_begin_ = 0) : y_begin(y_begin_), offsets(1, 0) {}
+
+  uint n_rows() const noexcept { return static_cast<uint>(offsets.size() - 1); }
+  uint y_end()  const noexcept { return y_begin + n_rows(); }
+  bool empty()  const noexcept { return runs.empty(); }
+
+  // Runs of row y (empty outside of the mask's rows)
+  span<const Run> row(uint y) const noexcept
+  {
+    if (y < y_begin || y >= y_end())
+      return {};
+
+    const uint i = y - y_begin;
+    return { runs.data() + offsets[i], offsets[i + 1] - offsets[i] };
+  }
+
+  void add_row(const std::vector<Run>& r)
+  {
+    runs.insert(runs.end(), r.begin(), r.end());
+    offsets.push_back( static_cast<uint>(runs.size()) );
+  }
+
+  uint64_t area() const noexcept;
+
+  uint              y_begin;
+  std::vector<uint> offsets; // n_rows() + 1 offsets into runs
+  std::vector<Run>  runs;
+};
+
+
+// (width & height are those of the map, whose edges bound every result)
+RunMask erode(const RunMask&, const StructuringElement&, uint width, uint height);
+RunMask dilate(const RunMask&, const StructuringElement&, uint width, uint height);
+RunMask open(const RunMask&, const StructuringElement&, uint width, uint height);
+RunMask close(const RunMask&, const StructuringElement&, uint width, uint height);
+
+
+// Mask of the entity at vertex `v` of a ProvinceIndex
+template<typename EntityT, typename CoordT>
+RunMask mask_of(const ProvinceIndex<EntityT, CoordT>& idx, uint v)
+{
+  const auto runs = idx.runs_of_vertex(v);
+
+  if (runs.empty())
+    return RunMask();
+
+  RunMask m(runs.front().y);
+  std::vector<RunMask::Run> row;
+  uint y = runs.front().y;
+
+  for (const auto& r : runs)
+  {
+    for (; y < r.y; ++y)
+    {
+      m.add_row(row);
+      row.clear();
+    }
+
+    row.push_back({ r.start, r.end });
+  }
+
+  m.add_row(row);
+  return m;
+}
+
+
+// Open every entity of the map, i.e. remove whatever the element doesn't fit into: single-pixel slivers, spikes
+// and jagged steps narrower than the element. The pixels an entity loses go to a neighboring entity whose own
+// opened shape, dilated by the element, reaches them (the one whose reach starts leftmost, then the lowest ID), or
+// stay put if no neighbor reaches them. Entities into which the element doesn't fit at all are left alone rather
+// than erased.
+//
+// Entities are opened in parallel, each in time proportional to its own runs, and the output rows are then
+// assembled in parallel bands, so the whole thing is O(segments * element height).
+
+template<typename EntityT, typename CoordT>
+SegmentMap<EntityT, CoordT> open_entities(const SegmentMap<EntityT, CoordT>& map, const StructuringElement& se,
+                                          std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+{
+  const uint width = map.width(), height = map.height();
+  const auto idx = build_province_index(map);
+  const uint n_vertices = idx.n_vertices();
+
+  std::vector<RunMask> kept(n_vertices), reach(n_vertices);
+
+  parallel_bands(n_vertices, [&](uint, uint v_begin, uint v_end)
+  {
+    for (uint v = v_begin; v < v_end; ++v)
+    {
+      auto mask = mask_of(idx, v);
+      auto opened = open(mask, se, width, height);
+      kept[v] = opened.empty() ? std::move(mask) : std::move(opened);
+      reach[v] = dilate(kept[v], se, width, height);
+    }
+  });
+
+  // Every row's reaches, as (run, vertex), sorted by run start
+  struct Claim
+  {
+    RunMask::Run run;
+    uint         v;
+  };
+
+  std::vector< std::vector<Claim> > claims(height);
+
+  for (uint v = 0; v < n_vertices; ++v)
+    for (uint y = reach[v].y_begin; y < reach[v].y_end(); ++y)
+      for (const auto& r : reach[v].row(y))
+        claims[y].push_back({ r, v });
+
+  SegmentMap<EntityT, CoordT> out(width, height, mr);
+
+  parallel_bands(height, [&](uint, uint y_begin, uint y_end)
+  {
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      auto& row_claims = claims[y];
+      std::sort(row_claims.begin(), row_claims.end(), [](const Claim& a, const Claim& b)
+      {
+        return a.run.start < b.run.start || (a.run.start == b.run.start && a.v < b.v);
+      });
+
+      auto& row = out.mutable_row(y);
+
+      auto emit = [&](EntityT id, uint end)
+      {
+        if (!row.empty() && row.back().id == id)
+          row.back().end = static_cast<CoordT>(end);
+        else
+          row.emplace_back(id, static_cast<CoordT>(end));
+      };
+
+      // Claims covering the current x, in start order (x only ever increases along the row)
+      size_t next_claim = 0;
+      std::vector<const Claim*> active;
+
+      // Give the orphaned pixels [a, b) of vertex `owner` to their claimants
+      auto assign_orphans = [&](uint owner, uint a, uint b)
+      {
+        while (a < b)
+        {
+          for (; next_claim < row_claims.size() && row_claims[next_claim].run.start <= a; ++next_claim)
+            active.push_back(&row_claims[next_claim]);
+
+          active.erase(std::remove_if(active.begin(), active.end(), [&](const Claim* c) { return c->run.end <= a; }),
+                       active.end());
+
+          auto it = std::find_if(active.begin(), active.end(), [&](const Claim* c) { return c->v != owner; });
+          const Claim* p_best = (it != active.end()) ? *it : nullptr;
+          const uint next_start = (next_claim < row_claims.size()) ? row_claims[next_claim].run.start : b;
+
+          if (p_best)
+          {
+            const uint end = std::min(b, p_best->run.end);
+            emit(idx.id(p_best->v), end);
+            a = end;
+          }
+          else
+          {
+            // (unclaimed until the next claim starts, if any: stays with its owner)
+            const uint end = std::min(b, next_start);
+            emit(idx.id(owner), end);
+            a = end;
+          }
+        }
+      };
+
+      uint x = 0;
+
+      for (const auto& seg : map[y])
+      {
+        const uint v = idx.vertex(seg.id);
+        const uint seg_end = seg.end;
+
+        const auto kept_row = kept[v].row(y);
+        auto it = std::upper_bound(kept_row.begin(), kept_row.end(), x,
+                                   [](uint x_, const RunMask::Run& r) { return x_ < r.end; });
+
+        for (; it != kept_row.end() && it->start < seg_end; ++it)
+        {
+          const auto& r = *it;
+
+          const uint kept_start = std::max(r.start, x), kept_end = std::min(r.end, seg_end);
+          assign_orphans(v, x, kept_start);
+          emit(seg.id, kept_end);
+          x = kept_end;
+        }
+
+        assign_orphans(v, x, seg_end);
+        x = seg_end;
+      }
+
+      if (y > y_begin)
+        out.dedup_row(y, y - 1);
+    }
+  }, 64);
+
+  return out;
+}
+
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef MAPSCALER_NEAREST_SCALER_H
+#define MAPSCALER_NEAREST_SCALER_H
+
+#include <limits>
+
+#include "Error.h"
+#include "SegmentMap.h"
+#include "common.h"
+
+
+// Nearest-neighbor integer upscaling of a SegmentMap. Every source pixel becomes a scale_x by scale_y block, so
+// this never has to touch pixels at all: segment ends are multiplied by scale_x and each source row is simply
+// emitted scale_y times, as shared rows (so the output costs no more memory than a horizontal-only scale).
+//
+// This is the baseline which the semantically-aware scaling stages refine; it's also exactly the coordinate
+// transform that every other per-pixel data file (adjacencies, positions) has to follow.
+//
+// The output map's storage comes from `mr` (e.g., the scaling stage's Arena).
+
+template<typename EntityT, typename CoordT>
+SegmentMap<EntityT, CoordT> scale_nearest(const SegmentMap<EntityT, CoordT>& src, uint scale_x, uint scale_y,
+                                          std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+{
+  assert(scale_x > 0 && scale_y > 0);
+
+  const auto out_width = static_cast<unsigned long long>(src.width()) * scale_x;
+  const auto out_height = static_cast<unsigned long long>(src.height()) * scale_y;
+
+  if (out_width > std::numeric_limits<CoordT>::max())
+    throw Error("Scaled width of {} pixels exceeds the segment coordinate limit of {}",
+                out_width, std::numeric_limits<CoordT>::max());
+
+  if (out_height > std::numeric_limits<uint>::max())
+    throw Error("Scaled height of {} pixels is too large", out_height);
+
+  SegmentMap<EntityT, CoordT> out(static_cast<uint>(out_width), static_cast<uint>(out_height), mr);
+
+  for (uint y = 0; y < src.height(); ++y)
+  {
+    if (y > 0 && src.same_row(y, y - 1))
+    {
+      for (uint dy = 0; dy < scale_y; ++dy)
+        out.share_row(y * scale_y + dy, y * scale_y - 1);
+
+      continue;
+    }
+
+    const auto& src_row = src[y];
+    auto& first_row = out.mutable_row(y * scale_y);
+    first_row.reserve(src_row.size());
+
+    for (const auto& seg : src_row)
+      first_row.emplace_back(seg.id, static_cast<CoordT>(seg.end * scale_x));
+
+    for (uint dy = 1; dy < scale_y; ++dy)
+      out.share_row(y * scale_y + dy, y * scale_y);
+  }
+
+  return out;
+}
+
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef MAPSCALER_NEIGHBOR_GRAPH_H
+#define MAPSCALER_NEIGHBOR_GRAPH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "EntitySet.h"
+#include "SegmentMap.h"
+#include "common.h"
+#include "parallel.h"
+
+
+// The province neighbor graph of a SegmentMap, in compressed sparse row (CSR) form. Vertices are the distinct
+// entity IDs which occur in the map (in ascending order), and every edge carries the length of the border shared
+// by its two entities, in pixel edges (a pixel's side is 1). Edges are stored in both directions, with the
+// neighbors of each vertex sorted by vertex index.
+
+template<typename EntityT>
+struct NeighborGraph
+{
+  struct Edge
+  {
+    uint vertex;     // index into ids()
+    uint border_len; // shared border length
+  };
+
+  NeighborGraph() : _M_offsets(1, 0) {}
+
+  auto n_vertices() const noexcept { return static_cast<uint>(_M_ids.size()); }
+  auto n_edges()    const noexcept { return static_cast<uint>(_M_edges.size() / 2); } // undirected
+
+  auto& ids() const noexcept { return _M_ids; }
+  auto  id(uint v) const noexcept { return _M_ids[v]; }
+
+  // Vertex index of `id`, or n_vertices() if the entity doesn't occur in the map.
+  uint vertex(EntityT id) const noexcept
+  {
+    auto it = std::lower_bound(_M_ids.begin(), _M_ids.end(), id);
+    return (it != _M_ids.end() && *it == id) ? static_cast<uint>(it - _M_ids.begin()) : n_vertices();
+  }
+
+  auto degree(uint v) const noexcept { return _M_offsets[v + 1] - _M_offsets[v]; }
+  auto begin(uint v)  const noexcept { return _M_edges.begin() + _M_offsets[v]; }
+  auto end(uint v)    const noexcept { return _M_edges.begin() + _M_offsets[v + 1]; }
+
+  // Shared border length between two vertices (0 if they aren't neighbors)
+  uint border_len(uint u, uint v) const noexcept
+  {
+    auto it = std::lower_bound(begin(u), end(u), v, [](const Edge& e, uint v_) { return e.vertex < v_; });
+    return (it != end(u) && it->vertex == v) ? it->border_len : 0;
+  }
+
+  template<typename E, typename C>
+  friend NeighborGraph<E> extract_neighbor_graph(const SegmentMap<E, C>&);
+
+private:
+  std::vector<EntityT> _M_ids;
+  std::vector<uint>    _M_offsets; // n_vertices() + 1 offsets into _M_edges
+  std::vector<Edge>    _M_edges;
+};
+
+
+// Extract the neighbor graph in a single sweep over the map. Horizontal adjacencies are simply consecutive
+// segments within a row. Vertical adjacencies come from walking each pair of consecutive rows with a merge-style
+// two-pointer over their segment ends, which visits every segment of both rows exactly once.
+//
+// Bands of row pairs are processed in parallel, each deduplicating its own edges & vertices (see EntitySet), and
+// the per-band results are then merged (sorted & summed) into the final graph, so the whole thing is linear in the
+// number of segments plus a sort of the (comparatively tiny) set of distinct edges.
+
+template<typename EntityT, typename CoordT>
+NeighborGraph<EntityT> extract_neighbor_graph(const SegmentMap<EntityT, CoordT>& map)
+{
+  static_assert(sizeof(EntityT) <= sizeof(uint32_t), "Edge keys pack two entity IDs into 64 bits");
+
+  using EdgeMap = std::unordered_map<uint64_t, uint>;
+
+  auto edge_key = [](EntityT a, EntityT b)
+  {
+    if (b < a) std::swap(a, b);
+    return (static_cast<uint64_t>(a) << 32) | static_cast<uint64_t>(b);
+  };
+
+  const uint n_rows = map.height();
+  const uint n_max_bands = max_bands(n_rows, 64);
+  std::vector<EdgeMap> band_edges(n_max_bands);
+  std::vector< EntitySet<EntityT> > band_ids(n_max_bands);
+
+  parallel_bands(n_rows, [&](uint band, uint y_begin, uint y_end)
+  {
+    auto& edges = band_edges[band];
+    auto& ids = band_ids[band];
+
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      const auto& row = map[y];
+
+      // horizontal adjacencies (and vertex collection)
+
+      for (size_t i = 0; i < row.size(); ++i)
+      {
+        ids.insert(row[i].id);
+
+        if (i > 0 && row[i - 1].id != row[i].id)
+          ++edges[ edge_key(row[i - 1].id, row[i].id) ];
+      }
+
+      if (y + 1 == n_rows || map.same_row(y, y + 1)) // identical rows have no vertical borders between them
+        continue;
+
+      // vertical adjacencies between row y & y+1
+
+      const auto& next = map[y + 1];
+      size_t i = 0, j = 0;
+      uint x = 0;
+
+      while (i < row.size() && j < next.size())
+      {
+        const uint end = std::min<uint>(row[i].end, next[j].end);
+
+        if (row[i].id != next[j].id)
+          edges[ edge_key(row[i].id, next[j].id) ] += end - x;
+
+        x = end;
+        if (row[i].end == end) ++i;
+        if (next[j].end == end) ++j;
+      }
+    }
+  }, 64);
+
+  /* reduction: merge per-band vertex sets and edge sets */
+
+  NeighborGraph<EntityT> g;
+
+  for (size_t band = 1; band < band_ids.size(); ++band)
+    band_ids[0].merge(band_ids[band]);
+
+  g._M_ids = band_ids[0].sorted();
+
+  std::vector< std::pair<uint64_t, uint> > edges;
+
+  for (auto& em : band_edges)
+    edges.insert(edges.end(), em.begin(), em.end());
+
+  std::sort(edges.begin(), edges.end());
+
+  size_t n_unique = 0;
+
+  for (size_t i = 0; i < edges.size(); ++i)
+  {
+    if (n_unique > 0 && edges[n_unique - 1].first == edges[i].first)
+      edges[n_unique - 1].second += edges[i].second;
+    else
+      edges[n_unique++] = edges[i];
+  }
+
+  edges.resize(n_unique);
+
+  /* build CSR (both directions) */
+
+  auto vertex_of = [&](uint64_t key_half) { return g.vertex(static_cast<EntityT>(key_half)); };
+
+  std::vector<uint> degree(g.n_vertices() + 1, 0);
+
+  for (const auto& [key, len] : edges)
+  {
+    ++degree[ vertex_of(key >> 32) ];
+    ++degree[ vertex_of(key & 0xFFFFFFFF) ];
+  }
+
+  g._M_offsets.assign(g.n_vertices() + 1, 0);
+
+  for (uint v = 0; v < g.n_vertices(); ++v)
+    g._M_offsets[v + 1] = g._M_offsets[v] + degree[v];
+
+  g._M_edges.resize(g._M_offsets.back());
+  std::vector<uint> fill(g._M_offsets.begin(), g._M_offsets.end() - 1);
+
+  // Edge keys are sorted by (low ID, high ID), and vertex indices preserve ID order. So if every vertex first
+  // receives its lower neighbors (in the pass where it's the high end) and then its higher neighbors, each
+  // neighbor list comes out sorted without any further work.
+
+  for (const auto& [key, len] : edges)
+  {
+    uint u = vertex_of(key >> 32), v = vertex_of(key & 0xFFFFFFFF);
+    g._M_edges[ fill[v]++ ] = { u, len };
+  }
+
+  for (const auto& [key, len] : edges)
+  {
+    uint u = vertex_of(key >> 32), v = vertex_of(key & 0xFFFFFFFF);
+    g._M_edges[ fill[u]++ ] = { v, len };
+  }
+
+  return g;
+}
+
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef MAPSCALER_OVERLAY_H
+#define MAPSCALER_OVERLAY_H
+
+#include <algorithm>
+#include <array>
+#include <tuple>
+#include <utility>
+
+#include "Error.h"
+#include "SegmentMap.h"
+#include "common.h"
+#include "parallel.h"
+
+
+// Overlay (a.k.a. zip or join) of several aligned SegmentMaps: each row is walked with a multi-way merge over
+// the segment ends of all of the maps at once, which yields the intersected runs, i.e. the maximal runs on which
+// none of the maps changes entity. Per-province terrain statistics, coast checks, and the like then become a sum
+// over (id_a, id_b, start, end) runs without ever expanding either map to pixels, at O(total segments).
+//
+// Entity & coordinate types may differ between the maps, but their dimensions must match.
+
+
+namespace overlay_detail {
+
+template<typename FuncT, typename RowsT, size_t... I>
+void overlay_row(uint y, uint width, const FuncT& fn, const RowsT& rows, std::index_sequence<I...>)
+{
+  std::array<size_t, sizeof...(I)> idx{}; // current segment of each row
+
+  for (uint start = 0; start < width; )
+  {
+    const uint end = std::min({ static_cast<uint>(std::get<I>(rows)[idx[I]].end)... });
+
+    fn(y, start, end, std::get<I>(rows)[idx[I]].id...);
+
+    // step past every segment which ends here
+    ((idx[I] += (std::get<I>(rows)[idx[I]].end == end) ? 1 : 0), ...);
+    start = end;
+  }
+}
+
+template<typename MapT, typename... MapsT>
+void check_aligned(const MapT& first, const MapsT& ...rest)
+{
+  if ( ((rest.width() != first.width() || rest.height() != first.height()) || ...) )
+    throw Error("Cannot overlay segment maps of different dimensions");
+}
+
+}
+
+
+// Calls fn(y, start_x, end_x, id_0, id_1, ...) for every intersected run of row y of the given maps, in order.
+template<typename FuncT, typename MapT, typename... MapsT>
+void overlay_row(uint y, const FuncT& fn, const MapT& first, const MapsT& ...rest)
+{
+  overlay_detail::overlay_row(y, first.width(), fn, std::forward_as_tuple(first[y], rest[y]...),
+                              std::make_index_sequence<1 + sizeof...(MapsT)>());
+}
+
+
+// Calls fn(y, start_x, end_x, id_0, id_1, ...) for every intersected run of the given maps, row by row.
+template<typename FuncT, typename MapT, typename... MapsT>
+void overlay(const FuncT& fn, const MapT& first, const MapsT& ...rest)
+{
+  overlay_detail::check_aligned(first, rest...);
+
+  for (uint y = 0; y < first.height(); ++y)
+    overlay_row(y, fn, first, rest...);
+}
+
+
+// Parallel overlay over bands of rows: fn(band, y, start_x, end_x, id_0, id_1, ...) is called concurrently for
+// different bands (but sequentially within a band), so per-band accumulators indexed by `band` need no locking.
+// Allocate them with max_overlay_bands() beforehand; returns the number of bands actually used.
+
+inline uint max_overlay_bands(uint height) noexcept { return max_bands(height, 64); }
+
+template<typename FuncT, typename MapT, typename... MapsT>
+uint overlay_bands(const FuncT& fn, const MapT& first, const MapsT& ...rest)
+{
+  overlay_detail::check_aligned(first, rest...);
+
+  return parallel_bands(first.height(), [&](uint band, uint y_begin, uint y_end)
+  {
+    auto band_fn = [&](uint y, uint start_x, uint end_x, auto... ids) { fn(band, y, start_x, end_x, ids...); };
+
+    for (uint y = y_begin; y < y_end; ++y)
+      overlay_row(y, band_fn, first, rest...);
+  }, 64);
+}
+
+
+#endif
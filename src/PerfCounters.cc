@@ -0,0 +1,231 @@
+#include "PerfCounters.h"
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+namespace {
+
+std::atomic<bool> g_enabled(false);
+
+
+#if defined(__linux__)
+
+constexpr uint64_t EVENT_CONFIG[N_PERF_EVENTS] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+
+int open_event(uint64_t config, bool inherit)
+{
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size           = sizeof(attr);
+  attr.type           = PERF_TYPE_HARDWARE;
+  attr.config         = config;
+  attr.inherit        = inherit;
+  attr.exclude_kernel = 1; // (unprivileged users may only count user space)
+  attr.exclude_hv     = 1;
+  attr.read_format    = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  return static_cast<int>( syscall(SYS_perf_event_open, &attr, 0 /* this thread */, -1 /* any CPU */, -1, 0) );
+}
+
+
+// Each event is opened twice per thread: once inherited by the threads it starts, and once not. (Inherited events
+// can't be read as a group on older kernels, so all of them are read one by one.)
+struct ThreadCounters
+{
+  ~ThreadCounters()
+  {
+    for (uint e = 0; e < N_PERF_EVENTS; ++e)
+    {
+      if (total_fd[e] >= 0) close(total_fd[e]);
+      if (own_fd[e] >= 0) close(own_fd[e]);
+    }
+  }
+
+  // Returns the bitmask of events opened, or 0 with errno set by the first failure
+  uint open()
+  {
+    if (!opened)
+    {
+      opened = true;
+      int first_errno = 0;
+
+      for (uint e = 0; e < N_PERF_EVENTS; ++e)
+      {
+        total_fd[e] = open_event(EVENT_CONFIG[e], true);
+        own_fd[e] = (total_fd[e] >= 0) ? open_event(EVENT_CONFIG[e], false) : -1;
+
+        if (total_fd[e] >= 0 && own_fd[e] >= 0)
+          available |= 1u << e;
+        else if (!first_errno)
+          first_errno = errno;
+      }
+
+      if (!available)
+        errno = first_errno;
+    }
+
+    return available;
+  }
+
+  void read_all(PerfScope::Readings& total, PerfScope::Readings& own) const noexcept
+  {
+    for (uint e = 0; e < N_PERF_EVENTS; ++e)
+    {
+      if (!(available & (1u << e)))
+        continue;
+
+      // (a short read leaves the zeroes in place, which merely reads as an idle counter)
+      if (::read(total_fd[e], &total[e], sizeof(total[e])) != sizeof(total[e])) total[e] = {};
+      if (::read(own_fd[e], &own[e], sizeof(own[e])) != sizeof(own[e])) own[e] = {};
+    }
+  }
+
+  int  total_fd[N_PERF_EVENTS] = { -1, -1, -1, -1 };
+  int  own_fd[N_PERF_EVENTS]   = { -1, -1, -1, -1 };
+  uint available = 0;
+  bool opened = false;
+};
+
+thread_local ThreadCounters t_counters;
+
+
+uint64_t delta(const PerfScope::Reading& begin, const PerfScope::Reading& end) noexcept
+{
+  const uint64_t value   = end.value - begin.value;
+  const uint64_t enabled = end.time_enabled - begin.time_enabled;
+  const uint64_t running = end.time_running - begin.time_running;
+
+  if (running == 0)
+    return 0;
+
+  // Extrapolate over the time the counter was scheduled out
+  return (running >= enabled) ? value : static_cast<uint64_t>( double(value) * double(enabled) / double(running) );
+}
+
+#endif // __linux__
+
+
+std::string si(uint64_t n)
+{
+  if (n >= 1'000'000'000)
+    return fmt::format("{:.2f} G", double(n) / 1e9);
+  else if (n >= 1'000'000)
+    return fmt::format("{:.2f} M", double(n) / 1e6);
+  else if (n >= 1'000)
+    return fmt::format("{:.2f} K", double(n) / 1e3);
+  else
+    return fmt::format("{} ", n);
+}
+
+}
+
+
+bool enable_perf_counters(std::string& why_not)
+{
+#if defined(__linux__)
+  if (t_counters.open() == 0)
+  {
+    why_not = (errno == EACCES || errno == EPERM)
+              ? fmt::format("{} (see /proc/sys/kernel/perf_event_paranoid)", strerror(errno))
+              : strerror(errno);
+    return false;
+  }
+
+  g_enabled.store(true);
+  return true;
+#else
+  why_not = "perf events are only supported on Linux";
+  return false;
+#endif
+}
+
+
+bool perf_counters_enabled() noexcept { return g_enabled.load(std::memory_order_relaxed); }
+
+
+PerfScope::PerfScope() noexcept
+: _M_available(0)
+{
+#if defined(__linux__)
+  if (perf_counters_enabled())
+  {
+    _M_available = t_counters.open();
+    t_counters.read_all(_M_total, _M_own);
+  }
+#endif
+}
+
+
+PerfStats PerfScope::stats() const noexcept
+{
+  PerfStats s;
+
+#if defined(__linux__)
+  if (_M_available)
+  {
+    Readings total, own;
+    t_counters.read_all(total, own);
+    s.available = _M_available;
+
+    for (uint e = 0; e < N_PERF_EVENTS; ++e)
+    {
+      s.total[e] = delta(_M_total[e], total[e]);
+      s.own[e]   = delta(_M_own[e], own[e]);
+    }
+  }
+#endif
+
+  return s;
+}
+
+
+std::string format_perf_stats(const PerfStats& s)
+{
+  std::string str;
+
+  auto append = [&](std::string_view part)
+  {
+    if (!str.empty()) str += ", ";
+    str += part;
+  };
+
+  const uint64_t cycles = s[PerfEvent::cycles];
+
+  if (s.has(PerfEvent::cycles))
+    append(si(cycles) + "cycles");
+
+  if (s.has(PerfEvent::instructions))
+  {
+    if (s.has(PerfEvent::cycles) && cycles)
+      append(fmt::format("IPC {:.2f}", double(s[PerfEvent::instructions]) / double(cycles)));
+    else
+      append(si(s[PerfEvent::instructions]) + "instructions");
+  }
+
+  if (s.has(PerfEvent::cache_misses))
+    append(si(s[PerfEvent::cache_misses]) + "cache misses");
+
+  if (s.has(PerfEvent::branch_misses))
+    append(si(s[PerfEvent::branch_misses]) + "branch misses");
+
+  // (only worth mentioning if other threads did a share of the work)
+  if (s.has(PerfEvent::cycles) && cycles)
+    if (const double pct = 100.0 * double(s.own[uint(PerfEvent::cycles)]) / double(cycles); pct < 99.5)
+      append(fmt::format("{:.0f}% of cycles on this thread", pct));
+
+  return str;
+}
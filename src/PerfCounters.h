@@ -0,0 +1,75 @@
+#ifndef MAPSCALER_PERF_COUNTERS_H
+#define MAPSCALER_PERF_COUNTERS_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "common.h"
+
+
+// Hardware performance counters (Linux perf events), for telling memory-bound stages from branch-bound ones.
+// Counting is off until enable_perf_counters() succeeds; afterward, each thread which measures a PerfScope opens
+// its own counters on first use. Where perf events are unavailable (other OSes, VMs without a virtual PMU, or
+// perf_event_paranoid > 2), enabling fails with a reason and every PerfScope is simply empty.
+//
+// A thread's counters also count every thread it starts after opening them, once that thread has exited, so a
+// scope around a parallel_bands() call sees the work of all of its bands.
+
+enum class PerfEvent : uint { cycles, instructions, cache_misses, branch_misses };
+
+constexpr uint N_PERF_EVENTS = 4;
+
+
+struct PerfStats
+{
+  // Indexed by PerfEvent. `total` is the measuring thread plus the threads it started & joined meanwhile; `own` is
+  // the measuring thread alone. Counts are scaled up if the kernel had to multiplex the counters.
+  std::array<uint64_t, N_PERF_EVENTS> total {};
+  std::array<uint64_t, N_PERF_EVENTS> own {};
+  uint                                available = 0; // bit per PerfEvent which could be counted
+
+  bool has(PerfEvent e) const noexcept { return available & (1u << uint(e)); }
+  bool empty() const noexcept          { return available == 0; }
+
+  uint64_t operator[](PerfEvent e) const noexcept { return total[uint(e)]; }
+};
+
+
+// Open counters for the calling thread (normally the main thread, before any worker threads exist). Returns false
+// and explains why in `why_not` if no events can be counted.
+bool enable_perf_counters(std::string& why_not);
+bool perf_counters_enabled() noexcept;
+
+
+// Measures the calling thread's counters over its lifetime. Must be measured (stats()) on the thread which
+// constructed it.
+struct PerfScope
+{
+  PerfScope() noexcept;
+
+  PerfScope(const PerfScope&) = delete;
+  PerfScope& operator=(const PerfScope&) = delete;
+
+  PerfStats stats() const noexcept;
+
+  // Raw counter value, as read from the kernel
+  struct Reading
+  {
+    uint64_t value = 0, time_enabled = 0, time_running = 0;
+  };
+
+  using Readings = std::array<Reading, N_PERF_EVENTS>;
+
+private:
+  Readings _M_total;
+  Readings _M_own;
+  uint     _M_available;
+};
+
+
+// e.g. "1.23 G cycles, IPC 1.45, 12.3 M cache misses, 4.56 M branch misses, 40% of cycles on this thread"
+std::string format_perf_stats(const PerfStats&);
+
+
+#endif
@@ -0,0 +1,305 @@
+#include "PixelArtScaler.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+#include "Error.h"
+#include "kernels.h"
+#include "parallel.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+namespace {
+
+IdRaster make_output(const IdRaster& src, uint factor, std::pmr::memory_resource* mr)
+{
+  const auto out_width = static_cast<unsigned long long>(src.width()) * factor;
+  const auto out_height = static_cast<unsigned long long>(src.height()) * factor;
+
+  if (out_width > std::numeric_limits<uint>::max() || out_height > std::numeric_limits<uint>::max())
+    throw Error("Scaled size of {}x{} pixels is too large", out_width, out_height);
+
+  return IdRaster(static_cast<uint>(out_width), static_cast<uint>(out_height), mr);
+}
+
+
+// Row y + dy, clamped to the raster
+inline const prov_id_t* row_at(const IdRaster& r, uint y, int dy)
+{
+  const int yy = std::clamp(int(y) + dy, 0, int(r.height()) - 1);
+  return r.row(static_cast<uint>(yy));
+}
+
+
+/* Scale3x */
+
+//   A B C        E0 E1 E2
+//   D E F   ->   E3 E4 E5
+//   G H I        E6 E7 E8
+void scale3x_row(const prov_id_t* above, const prov_id_t* row, const prov_id_t* below, uint width,
+                 prov_id_t* out0, prov_id_t* out1, prov_id_t* out2)
+{
+  for (uint x = 0; x < width; ++x)
+  {
+    const uint xl = (x > 0) ? x - 1 : x, xr = (x + 1 < width) ? x + 1 : x;
+    const prov_id_t a = above[xl], b = above[x], c = above[xr];
+    const prov_id_t d = row[xl],   e = row[x],   f = row[xr];
+    const prov_id_t g = below[xl], h = below[x], i = below[xr];
+
+    prov_id_t* p0 = out0 + 3 * x;
+    prov_id_t* p1 = out1 + 3 * x;
+    prov_id_t* p2 = out2 + 3 * x;
+
+    if (b == h || d == f) // (on a straight border, or none at all)
+    {
+      p0[0] = p0[1] = p0[2] = p1[0] = p1[1] = p1[2] = p2[0] = p2[1] = p2[2] = e;
+      continue;
+    }
+
+    p0[0] = (d == b) ? d : e;
+    p0[1] = ((d == b && e != c) || (b == f && e != a)) ? b : e;
+    p0[2] = (b == f) ? f : e;
+    p1[0] = ((d == b && e != g) || (d == h && e != a)) ? d : e;
+    p1[1] = e;
+    p1[2] = ((b == f && e != i) || (h == f && e != c)) ? f : e;
+    p2[0] = (d == h) ? d : e;
+    p2[1] = ((d == h && e != i) || (h == f && e != g)) ? h : e;
+    p2[2] = (h == f) ? f : e;
+  }
+}
+
+
+/* xBR */
+
+// Every corner is handled as the bottom-right one, in a frame rotated to put it there: local (i, j) is the pixel
+// at global offset rotate(corner, i, j) from the center, with local +i toward F and +j toward H.
+//
+//        A1 B1 C1
+//     A0 A  B  C  C4
+//     D0 D  E  F  F4
+//     G0 G  H  I  I4
+//        G5 H5 I5
+enum Corner { BOTTOM_RIGHT, BOTTOM_LEFT, TOP_LEFT, TOP_RIGHT };
+
+constexpr uint MAX_FACTOR = 4;
+
+inline void rotate(uint corner, int i, int j, int& dx, int& dy) noexcept
+{
+  switch (corner)
+  {
+  case BOTTOM_RIGHT: dx = i;  dy = j;  break;
+  case BOTTOM_LEFT:  dx = -j; dy = i;  break;
+  case TOP_LEFT:     dx = -i; dy = -j; break;
+  default:           dx = j;  dy = -i; break;
+  }
+}
+
+
+// For each corner, which of a block's factor x factor subpixels lie beyond each kind of border through it. In the
+// corner's frame, with (u, v) the subpixel center within the source pixel ([0, 1] each way, the corner at (1, 1)):
+//
+//   45-degree border (edr):   u + v >= 3/2
+//   shallow border (left):    u + 2v >= 2   (i.e., from the middle of the far side to the opposite corner)
+//   steep border (up):        2u + v >= 2
+struct CornerMasks
+{
+  std::vector<bool> edr, left, up; // by subpixel, row-major in the output's orientation
+};
+
+std::vector<CornerMasks> corner_masks(uint n)
+{
+  std::vector<CornerMasks> masks(4);
+  const int in = int(n);
+
+  for (uint corner = 0; corner < 4; ++corner)
+  {
+    auto& m = masks[corner];
+    m.edr.resize(n * n);
+    m.left.resize(n * n);
+    m.up.resize(n * n);
+
+    for (int sy = 0; sy < in; ++sy)
+    {
+      for (int sx = 0; sx < in; ++sx)
+      {
+        // Subpixel center's offset from the pixel center, in units of 1/(2n); then into the corner's frame (the
+        // inverse rotation)
+        const int gx = 2 * sx + 1 - in, gy = 2 * sy + 1 - in;
+        int lx, ly;
+
+        switch (corner)
+        {
+        case BOTTOM_RIGHT: lx = gx;  ly = gy;  break;
+        case BOTTOM_LEFT:  lx = gy;  ly = -gx; break;
+        case TOP_LEFT:     lx = -gx; ly = -gy; break;
+        default:           lx = -gy; ly = gx;  break;
+        }
+
+        const int u = lx + in, v = ly + in; // (2n * u, 2n * v)
+        const size_t s = size_t(sy) * n + size_t(sx);
+
+        m.edr[s] = (u + v >= 3 * in);
+        m.left[s] = (u + 2 * v >= 4 * in);
+        m.up[s] = (2 * u + v >= 4 * in);
+      }
+    }
+  }
+
+  return masks;
+}
+
+
+void xbr_row(const IdRaster& src, uint y, uint n, const std::vector<CornerMasks>& masks, IdRaster& out)
+{
+  const uint width = src.width();
+  const prov_id_t* rows[5];
+
+  for (int dy = -2; dy <= 2; ++dy)
+    rows[dy + 2] = row_at(src, y, dy);
+
+  std::vector<prov_id_t*> out_rows(n);
+
+  for (uint sy = 0; sy < n; ++sy)
+    out_rows[sy] = out.row(y * n + sy);
+
+  for (uint x = 0; x < width; ++x)
+  {
+    auto at = [&](int dx, int dy)
+    {
+      const int xx = std::clamp(int(x) + dx, 0, int(width) - 1);
+      return rows[dy + 2][xx];
+    };
+
+    const prov_id_t e = rows[2][x];
+
+    for (uint sy = 0; sy < n; ++sy)
+      std::fill_n(out_rows[sy] + x * n, n, e);
+
+    // (the vast majority of pixels are in the interior of a province)
+    if (at(-1, 0) == e && at(1, 0) == e && at(0, -1) == e && at(0, 1) == e)
+      continue;
+
+    // Each corner claims the subpixels beyond its border. Where the regions of two corners overlap (at 3x & 4x),
+    // they must agree, or the subpixel stays put; that way, the result doesn't depend on the order of the corners.
+    prov_id_t claim[MAX_FACTOR * MAX_FACTOR];
+    bool claimed[MAX_FACTOR * MAX_FACTOR] = {}, conflict[MAX_FACTOR * MAX_FACTOR] = {};
+
+    for (uint corner = 0; corner < 4; ++corner)
+    {
+      auto px = [&](int i, int j)
+      {
+        int dx, dy;
+        rotate(corner, i, j, dx, dy);
+        return at(dx, dy);
+      };
+
+      const prov_id_t f = px(1, 0), h = px(0, 1);
+
+      if (e == f || e == h)
+        continue;
+
+      const prov_id_t b = px(0, -1), c = px(1, -1), d = px(-1, 0), g = px(-1, 1), i = px(1, 1);
+      const prov_id_t f4 = px(2, 0), h5 = px(0, 2), i4 = px(2, 1), i5 = px(1, 2);
+
+      // (don't eat into the corners of thin lines or of single pixels)
+      if (!((f != b && h != d) || (e == i && f != i4 && h != i5) || e == g || e == c))
+        continue;
+
+      // Differences (counted as unequal pairs) across the corner's diagonal vs. along it
+      const int wd_across = (e != c) + (e != g) + (i != h5) + (i != f4) + 4 * (h != f);
+      const int wd_along = (h != d) + (h != i5) + (f != i4) + (f != b) + 4 * (e != i);
+
+      if (wd_across >= wd_along)
+        continue;
+
+      const bool left = (f == g && e != g && d != g); // shallow border through F & G
+      const bool up = (h == c && e != c && b != c);   // steep border through H & C
+
+      // The ID beyond the border: the one the border runs along, if it's shallow or steep; else F or H, preferring
+      // the one which agrees with I
+      const prov_id_t beyond = (up && !left) ? h : (left && !up) ? f : (f == i || h != i) ? f : h;
+      const auto& m = masks[corner];
+
+      for (uint s = 0; s < n * n; ++s)
+      {
+        if (!(m.edr[s] || (left && m.left[s]) || (up && m.up[s])))
+          continue;
+
+        if (claimed[s] && claim[s] != beyond)
+          conflict[s] = true;
+
+        claimed[s] = true;
+        claim[s] = beyond;
+      }
+    }
+
+    for (uint s = 0; s < n * n; ++s)
+      if (claimed[s] && !conflict[s])
+        out_rows[s / n][x * n + s % n] = claim[s];
+  }
+}
+
+}
+
+
+IdRaster scale2x(const IdRaster& src, std::pmr::memory_resource* mr)
+{
+  IdRaster out = make_output(src, 2, mr);
+
+  parallel_bands(src.height(), [&](uint, uint y_begin, uint y_end)
+  {
+    const auto& k = kernels();
+
+    for (uint y = y_begin; y < y_end; ++y)
+      k.scale2x_id16(row_at(src, y, -1), src.row(y), row_at(src, y, 1), src.width(),
+                     out.row(2 * y), out.row(2 * y + 1));
+  }, 16);
+
+  return out;
+}
+
+
+IdRaster scale3x(const IdRaster& src, std::pmr::memory_resource* mr)
+{
+  IdRaster out = make_output(src, 3, mr);
+
+  parallel_bands(src.height(), [&](uint, uint y_begin, uint y_end)
+  {
+    for (uint y = y_begin; y < y_end; ++y)
+      scale3x_row(row_at(src, y, -1), src.row(y), row_at(src, y, 1), src.width(),
+                  out.row(3 * y), out.row(3 * y + 1), out.row(3 * y + 2));
+  }, 16);
+
+  return out;
+}
+
+
+IdRaster scale4x(const IdRaster& src, std::pmr::memory_resource* mr)
+{
+  return scale2x(scale2x(src), mr);
+}
+
+
+IdRaster scale_xbr(const IdRaster& src, uint factor, std::pmr::memory_resource* mr)
+{
+  if (factor < 2 || factor > MAX_FACTOR)
+    throw Error("xBR scaling factor must be 2, 3, or 4 (not {})", factor);
+
+  IdRaster out = make_output(src, factor, mr);
+  const auto masks = corner_masks(factor);
+
+  parallel_bands(src.height(), [&](uint, uint y_begin, uint y_end)
+  {
+    for (uint y = y_begin; y < y_end; ++y)
+      xbr_row(src, y, factor, masks, out);
+  }, 16);
+
+  return out;
+}
+
+
+//NAMESPACE_CK2_END;
@@ -0,0 +1,35 @@
+#ifndef MAPSCALER_PIXEL_ART_SCALER_H
+#define MAPSCALER_PIXEL_ART_SCALER_H
+
+#include <memory_resource>
+
+#include "IdRaster.h"
+#include "common.h"
+
+
+// Edge-directed pixel-art upscalers over province IDs. Nearest-neighbor scaling turns every diagonal border into a
+// staircase of scale-sized steps; these look at each pixel's neighborhood to find the borders running through it
+// and cut the corners of its block along them instead. Pixels are only ever compared for equality, and every
+// output pixel takes the ID of its source pixel or of one of that pixel's neighbors, so no new IDs appear.
+//
+// All of them run in parallel bands of source rows. The output raster's storage comes from `mr`.
+
+// Scale2x (EPX): a corner of a pixel's 2x2 block takes the ID of the two neighbors on that side when they agree
+// (and the pixel isn't on a straight border). Vectorized (see kernels.h).
+IdRaster scale2x(const IdRaster&, std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+// Scale3x (AdvMAME3x): the same idea over a 3x3 block, where the edge centers also follow 45-degree borders
+IdRaster scale3x(const IdRaster&, std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+// Scale4x: Scale2x twice
+IdRaster scale4x(const IdRaster&, std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+// xBR (level 2) by `factor` (2, 3, or 4): each corner of a pixel decides whether a border cuts it by weighing the
+// differences along the two diagonals over a 5x5 neighborhood (here: counting unequal pairs), which keeps the
+// thin lines & sharp corners that Scale2x rounds off, and follows shallow & steep (2:1) borders as well as 45-degree
+// ones. The block's subpixels on the far side of the border take the neighbor's ID outright; there's no blending.
+IdRaster scale_xbr(const IdRaster&, uint factor,
+                   std::pmr::memory_resource* mr = std::pmr::get_default_resource());
+
+
+#endif
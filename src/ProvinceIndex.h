@@ -0,0 +1,198 @@
+#ifndef MAPSCALER_PROVINCE_INDEX_H
+#define MAPSCALER_PROVINCE_INDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+#include "EntitySet.h"
+#include "SegmentMap.h"
+#include "common.h"
+#include "parallel.h"
+
+
+// Inverted index of a SegmentMap: for every entity, the runs it occupies, as (y, start, end) in compressed sparse
+// row (CSR) form. Each entity's runs are contiguous and sorted by row (top to bottom) and then by x, so per-entity
+// work (contour tracing, statistics, ...) costs time proportional to that entity's size instead of a sweep over
+// the whole map, and entity-parallel work is just a parallel_bands() over vertex indices.
+//
+// Vertices are the distinct entity IDs which occur in the map, in ascending order (as in NeighborGraph).
+
+template<typename EntityT, typename CoordT>
+struct ProvinceIndex
+{
+  struct Run
+  {
+    uint   y;
+    CoordT start, end; // [start, end)
+  };
+
+  ProvinceIndex() : _M_offsets(1, 0) {}
+
+  auto n_vertices() const noexcept { return static_cast<uint>(_M_ids.size()); }
+  auto n_runs()     const noexcept { return static_cast<uint>(_M_runs.size()); }
+
+  auto& ids() const noexcept { return _M_ids; }
+  auto  id(uint v) const noexcept { return _M_ids[v]; }
+
+  // Vertex index of `id`, or n_vertices() if the entity doesn't occur in the map.
+  uint vertex(EntityT id) const noexcept
+  {
+    auto it = std::lower_bound(_M_ids.begin(), _M_ids.end(), id);
+    return (it != _M_ids.end() && *it == id) ? static_cast<uint>(it - _M_ids.begin()) : n_vertices();
+  }
+
+  span<const Run> runs_of_vertex(uint v) const noexcept
+  {
+    return { _M_runs.data() + _M_offsets[v], _M_offsets[v + 1] - _M_offsets[v] };
+  }
+
+  // Runs of `id` (empty if the entity doesn't occur in the map)
+  span<const Run> runs(EntityT id) const noexcept
+  {
+    const uint v = vertex(id);
+    return (v < n_vertices()) ? runs_of_vertex(v) : span<const Run>();
+  }
+
+  // Area of `id` in pixels
+  uint64_t area(EntityT id) const noexcept
+  {
+    uint64_t n = 0;
+
+    for (const auto& r : runs(id))
+      n += r.end - r.start;
+
+    return n;
+  }
+
+  template<typename E, typename C>
+  friend ProvinceIndex<E, C> build_province_index(const SegmentMap<E, C>&);
+
+private:
+  std::vector<EntityT> _M_ids;
+  std::vector<uint>    _M_offsets; // n_vertices() + 1 offsets into _M_runs
+  std::vector<Run>     _M_runs;
+};
+
+
+// Build the index with a parallel sweep over the map followed by a parallel counting sort. Each band of rows
+// gathers its runs (in row order) and the set of entities it saw (see EntitySet); it then counts its runs per
+// entity, and prefix sums over (entity, band) give every band a private slice of each entity's range, so the
+// bands scatter their runs without any synchronization and each entity's runs come out in row order with no
+// sorting of runs at all.
+
+template<typename EntityT, typename CoordT>
+ProvinceIndex<EntityT, CoordT> build_province_index(const SegmentMap<EntityT, CoordT>& map)
+{
+  using Run = typename ProvinceIndex<EntityT, CoordT>::Run;
+
+  struct BandRuns
+  {
+    std::vector< std::pair<EntityT, Run> > runs;
+    EntitySet<EntityT>                     ids;
+    std::vector<uint>                      counts; // per vertex
+  };
+
+  const uint n_rows = map.height();
+  std::vector<BandRuns> bands( max_bands(n_rows, 64) );
+
+  /* gather */
+
+  const uint n_bands = parallel_bands(n_rows, [&](uint band, uint y_begin, uint y_end)
+  {
+    auto& b = bands[band];
+
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      CoordT start_x = 0;
+
+      for (const auto& seg : map[y])
+      {
+        b.runs.push_back({ seg.id, { y, start_x, seg.end } });
+        b.ids.insert(seg.id);
+        start_x = seg.end;
+      }
+    }
+  }, 64);
+
+  ProvinceIndex<EntityT, CoordT> idx;
+
+  for (uint band = 1; band < n_bands; ++band)
+    bands[0].ids.merge(bands[band].ids);
+
+  idx._M_ids = bands[0].ids.sorted();
+
+  const uint n_vertices = idx.n_vertices();
+
+  // Entity IDs are normally small integers (prov_id_t), in which case a direct lookup table beats a binary search
+  // per run. (Fall back to the search for sparse or wide ID spaces.)
+  std::vector<uint> dense_vertex;
+
+  if (n_vertices > 0 && static_cast<uint64_t>(idx._M_ids.back()) < (uint64_t(1) << 20))
+  {
+    dense_vertex.resize( static_cast<size_t>(idx._M_ids.back()) + 1 );
+
+    for (uint v = 0; v < n_vertices; ++v)
+      dense_vertex[ static_cast<size_t>(idx._M_ids[v]) ] = v;
+  }
+
+  auto vertex_of = [&](EntityT id)
+  {
+    return dense_vertex.empty() ? idx.vertex(id) : dense_vertex[ static_cast<size_t>(id) ];
+  };
+
+  /* count */
+
+  parallel_bands(n_bands, [&](uint, uint b_begin, uint b_end)
+  {
+    for (uint band = b_begin; band < b_end; ++band)
+    {
+      auto& b = bands[band];
+      b.counts.assign(n_vertices, 0);
+
+      for (const auto& [id, run] : b.runs)
+        ++b.counts[ vertex_of(id) ];
+    }
+  });
+
+  /* prefix sums: turn each band's counts into its write cursors */
+
+  idx._M_offsets.assign(n_vertices + 1, 0);
+
+  for (uint v = 0; v < n_vertices; ++v)
+  {
+    uint cursor = idx._M_offsets[v];
+
+    for (uint band = 0; band < n_bands; ++band)
+    {
+      const uint n = bands[band].counts[v];
+      bands[band].counts[v] = cursor;
+      cursor += n;
+    }
+
+    idx._M_offsets[v + 1] = cursor;
+  }
+
+  /* scatter */
+
+  idx._M_runs.resize(idx._M_offsets.back());
+
+  parallel_bands(n_bands, [&](uint, uint b_begin, uint b_end)
+  {
+    for (uint band = b_begin; band < b_end; ++band)
+    {
+      auto& b = bands[band];
+
+      for (const auto& [id, run] : b.runs)
+        idx._M_runs[ b.counts[ vertex_of(id) ]++ ] = run;
+
+      b.runs = {}; // (free as we go)
+    }
+  });
+
+  return idx;
+}
+
+
+#endif
@@ -0,0 +1,116 @@
+#include "ProvinceSegmenter.h"
+
+#include <ck2/FileLocation.h>
+#include "RowSegmentStream.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+namespace {
+
+// Row callback shared by both variants. Rows arrive bottom-to-top or top-to-bottom (see BMPReader::RowOrder), so
+// the row completed just before row y is its neighbor on the side of the range at which reading began, unless y
+// is the first row read.
+struct RowSink
+{
+  const BMPReader&  bmp;
+  const ColorIndex& color_idx;
+  ProvSegmentMap&   map;
+  uint              y_begin;
+  uint              y_end;
+
+  void operator()(span<const BMPReader::RowSegment> segs, uint y) const
+  {
+    assert(y >= y_begin && y < y_end);
+    assert(!segs.empty() && segs.back().end == bmp.width());
+
+    const uint map_y = y - y_begin;
+    auto& row = map.mutable_row(map_y);
+    row.resize(segs.size());
+
+    // Resolve the whole row's colors. Consecutive segments of a row alternate between few colors, so it pays to
+    // remember the last lookup.
+    BGR last_color = segs[0].color;
+    const prov_id_t* p_id = color_idx.find(last_color);
+
+    for (size_t i = 0; i < segs.size(); ++i)
+    {
+      if (segs[i].color != last_color)
+      {
+        last_color = segs[i].color;
+        p_id = color_idx.find(last_color);
+      }
+
+      if (!p_id)
+        throw_stray_color(bmp, segs, i, y);
+
+      row[i] = { *p_id, static_cast<ProvSegmentMap::coord_type>(segs[i].end) };
+    }
+
+    if (!bmp.emits_top_down() && y + 1 < y_end)
+      map.dedup_row(map_y, map_y + 1);
+    else if (bmp.emits_top_down() && y > y_begin)
+      map.dedup_row(map_y, map_y - 1);
+  }
+};
+
+}
+
+
+void throw_stray_color(const BMPReader& bmp, span<const BMPReader::RowSegment> segs, size_t i, uint y)
+{
+  const auto& color = segs[i].color;
+  const uint start_x = (i == 0) ? 0 : segs[i - 1].end;
+  const uint end_x = segs[i].end;
+
+  if (end_x - 1 > start_x)
+  {
+    throw FLError(FLoc(bmp.path()),
+                  "Stray color of RGB({}, {}, {}) in provinces bitmap at pixels (x:{} to {}, y:{})",
+                  color.red(), color.green(), color.blue(), start_x, end_x - 1, y);
+  }
+  else
+  {
+    throw FLError(FLoc(bmp.path()),
+                  "Stray color of RGB({}, {}, {}) in provinces bitmap at pixel (x:{}, y:{})",
+                  color.red(), color.green(), color.blue(), start_x, y);
+  }
+}
+
+
+void segment_provinces(BMPReader& bmp, const ColorIndex& color_idx, ProvSegmentMap& map)
+{
+  assert(map.width() == bmp.width() && map.height() == bmp.height());
+  bmp.foreach_row_segments( RowSink{ bmp, color_idx, map, 0, bmp.height() } );
+}
+
+
+void segment_provinces(const BMPReader& bmp, const ColorIndex& color_idx, ProvSegmentMap& map,
+                       uint y_begin, uint y_end)
+{
+  assert(y_begin < y_end && y_end <= bmp.height());
+  assert(map.width() == bmp.width() && map.height() >= y_end - y_begin);
+
+  bmp.foreach_row_segments( RowSink{ bmp, color_idx, map, y_begin, y_end },
+                            bmp.first_row_of(y_begin, y_end), y_end - y_begin );
+}
+
+
+void segment_provinces(RowSegmentStream& stream, const ColorIndex& color_idx, ProvSegmentMap& map,
+                       uint y_begin, uint n_rows)
+{
+  const RowSink sink{ stream.reader(), color_idx, map, y_begin, y_begin + map.height() };
+
+  for (uint i = 0; i < n_rows; ++i)
+  {
+    const bool more = stream.next();
+    assert(more);
+    (void)more;
+    sink(stream.segments(), stream.y());
+  }
+}
+
+
+//NAMESPACE_CK2_END;
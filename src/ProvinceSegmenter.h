@@ -0,0 +1,34 @@
+#ifndef MAPSCALER_PROVINCE_SEGMENTER_H
+#define MAPSCALER_PROVINCE_SEGMENTER_H
+
+#include "BMPReader.h"
+#include "ColorIndex.h"
+#include "SegmentMap.h"
+#include "common.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2; // until it is actually in the lib
+
+
+struct RowSegmentStream;
+
+
+// Segment the provinces bitmap into `map` (which must have the bitmap's dimensions), resolving colors to province
+// IDs. Throws upon the first stray color; use MapValidator to find all of them at once instead.
+void segment_provinces(BMPReader&, const ColorIndex&, ProvSegmentMap& map);
+
+// Segment only the rows [y_begin, y_end) of the bitmap (y counted from the top), such that row y_begin lands in
+// row 0 of `map`. Uses a private file handle, so it's safe to call concurrently on different row ranges.
+void segment_provinces(const BMPReader&, const ColorIndex&, ProvSegmentMap& map, uint y_begin, uint y_end);
+
+// Segment the next `n_rows` rows of `stream` into `map`, whose row 0 is row y_begin of the bitmap (so the rows
+// must fall within [y_begin, y_begin + map.height())). For reading a bitmap band by band through a single stream.
+void segment_provinces(RowSegmentStream&, const ColorIndex&, ProvSegmentMap& map, uint y_begin, uint n_rows);
+
+// Throw the error for the stray color of segment i of a row of segments read from `bmp` (row y)
+[[noreturn]] void throw_stray_color(const BMPReader&, span<const BMPReader::RowSegment> segs, size_t i, uint y);
+
+
+//NAMESPACE_CK2_END;
+#endif
@@ -0,0 +1,37 @@
+#include "RLEDecoder.h"
+
+#include <ck2/FileLocation.h>
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+RLEDecoder::RLEDecoder(const fs::path& path, uint64_t offset, uint64_t size, uint width, uint bpp,
+                       const std::vector<BGR>& palette, size_t block_size)
+: _M_reader(path, offset, size, block_size, READ_DEPTH)
+, _M_palette(palette)
+, _M_p(nullptr)
+, _M_left(0)
+, _M_width(width)
+, _M_bpp(bpp)
+, _M_x(0)
+, _M_carry_x(0)
+, _M_blank_rows(0)
+, _M_eob(false)
+{
+  assert(bpp == 8 || bpp == 4);
+}
+
+
+uint8_t RLEDecoder::refill()
+{
+  if ( !(_M_p = _M_reader.next(_M_left)) || _M_left == 0 )
+    throw FLError(FLoc(_M_reader.path()), "Unexpected end of RLE-compressed bitmap data (file corruption)");
+
+  --_M_left;
+  return *_M_p++;
+}
+
+
+//NAMESPACE_CK2_END;
@@ -0,0 +1,171 @@
+#ifndef MAPSCALER_RLE_DECODER_H
+#define MAPSCALER_RLE_DECODER_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+#include <ck2/Color.h>
+#include "AsyncReader.h"
+#include "common.h"
+#include "filesystem.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2; // until it is actually in the lib
+
+
+// Decoder for RLE8- and RLE4-compressed bitmap data which produces rows of segments straight from the encoded
+// runs: an encoded run is already a segment (or extends the previous one, if it has the same color), so pixels
+// are never materialized. Only absolute-mode (literal) stretches are handled pixel by pixel.
+//
+// Pixels which the encoding leaves undefined (skipped by delta escapes, the remainder of a row cut short by an
+// end-of-line, or everything after the end-of-bitmap marker) are given palette index 0. Rows are produced in
+// file order (bottom-to-top). The palette must have an entry for every index the bit depth can express.
+
+struct RLEDecoder
+{
+  static constexpr size_t BLOCK_SIZE = 1 << 20; // default bytes per read
+  static constexpr uint   READ_DEPTH = 2;       // blocks in flight
+
+  RLEDecoder(const fs::path&, uint64_t offset, uint64_t size, uint width, uint bpp, const std::vector<BGR>& palette,
+             size_t block_size = BLOCK_SIZE);
+
+  // Decode the next row into `segs` (a vector of {color, end} segments, which is cleared first)
+  template<typename VecT>
+  void next_row(VecT& segs);
+
+private:
+  uint8_t get() { return (_M_left > 0) ? (--_M_left, *_M_p++) : refill(); }
+  uint8_t refill();
+
+  template<typename VecT>
+  void emit(VecT& segs, uint8_t index, uint n);
+
+  template<typename VecT>
+  void finish_row(VecT& segs) { emit(segs, 0, _M_width - _M_x); }
+
+  AsyncReader              _M_reader;
+  const std::vector<BGR>&  _M_palette;
+  const uint8_t*           _M_p;
+  size_t                   _M_left;
+  uint                     _M_width;
+  uint                     _M_bpp;
+  uint                     _M_x;          // next x-coordinate in the row being decoded
+  uint                     _M_carry_x;    // undefined pixels at the start of the next decoded row (delta escape)
+  uint                     _M_blank_rows; // undefined rows to produce before decoding resumes (delta escape)
+  bool                     _M_eob;        // end-of-bitmap seen
+};
+
+
+template<typename VecT>
+void RLEDecoder::emit(VecT& segs, uint8_t index, uint n)
+{
+  n = std::min(n, _M_width - _M_x); // runs overflowing the row are clipped
+
+  if (n == 0)
+    return;
+
+  const BGR color = _M_palette[index];
+  _M_x += n;
+
+  if (!segs.empty() && segs.back().color == color)
+    segs.back().end = _M_x;
+  else
+    segs.push_back({ color, _M_x });
+}
+
+
+template<typename VecT>
+void RLEDecoder::next_row(VecT& segs)
+{
+  segs.clear();
+  _M_x = 0;
+
+  if (_M_eob || _M_blank_rows > 0)
+  {
+    if (_M_blank_rows > 0) --_M_blank_rows;
+    finish_row(segs);
+    return;
+  }
+
+  emit(segs, 0, _M_carry_x);
+  _M_carry_x = 0;
+
+  for (;;)
+  {
+    const uint8_t count = get();
+    const uint8_t value = get();
+
+    if (count > 0) // encoded run
+    {
+      if (_M_bpp == 8)
+        emit(segs, value, count);
+      else if (const uint8_t hi = value >> 4, lo = value & 0xF; hi == lo)
+        emit(segs, hi, count);
+      else
+        for (uint i = 0; i < count; ++i) // alternating nibbles
+          emit(segs, (i & 1) ? lo : hi, 1);
+
+      continue;
+    }
+
+    switch (value)
+    {
+    case 0: // end of line
+      finish_row(segs);
+      return;
+
+    case 1: // end of bitmap
+      finish_row(segs);
+      _M_eob = true;
+      return;
+
+    case 2: // delta: skip dx pixels to the right & dy rows up
+    {
+      const uint dx = get(), dy = get();
+
+      if (dy == 0)
+      {
+        emit(segs, 0, dx);
+        break;
+      }
+
+      _M_carry_x = std::min(_M_x + dx, _M_width);
+      _M_blank_rows = dy - 1;
+      finish_row(segs);
+      return;
+    }
+
+    default: // absolute mode: `value` literal pixels, padded to a 16-bit boundary
+    {
+      const uint n = value;
+
+      if (_M_bpp == 8)
+      {
+        for (uint i = 0; i < n; ++i)
+          emit(segs, get(), 1);
+
+        if (n & 1) get();
+      }
+      else
+      {
+        const uint n_bytes = (n + 1) / 2;
+
+        for (uint i = 0; i < n_bytes; ++i)
+        {
+          const uint8_t b = get();
+          emit(segs, b >> 4, 1);
+          if (2 * i + 1 < n) emit(segs, b & 0xF, 1);
+        }
+
+        if (n_bytes & 1) get();
+      }
+    }
+    }
+  }
+}
+
+
+//NAMESPACE_CK2_END;
+#endif
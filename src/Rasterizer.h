@@ -0,0 +1,377 @@
+#ifndef MAPSCALER_RASTERIZER_H
+#define MAPSCALER_RASTERIZER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "BorderGraph.h"
+#include "EntitySet.h"
+#include "SegmentMap.h"
+#include "common.h"
+#include "parallel.h"
+
+
+// Scanline rasterization of a planar partition (a set of polygons covering the map without gaps or overlaps, such
+// as a scaled or simplified BorderGraph) back into a SegmentMap.
+//
+// The partition is given by its border edges, each knowing the entity on either side, so no polygon ever has to
+// be assembled and every border is crossed exactly once per scanline: a shared border can't leave a gap or be
+// filled twice. Each pixel gets the entity covering its center, with two tie-breaking rules making the result
+// independent of edge order: an edge covers the scanlines whose centers lie in [y_min, y_max) (so of two edges
+// meeting at a vertex exactly on a scanline, only one counts), and a pixel center lying exactly on an edge belongs
+// to the edge's east side.
+
+// A straight border edge, in pixel coordinates (y grows downward). Walking from (x0, y0) to (x1, y1), `left` lies
+// on the left-hand side; if `outer`, the right-hand side is outside the map (and `right` is meaningless).
+template<typename EntityT>
+struct RasterEdge
+{
+  double  x0, y0, x1, y1;
+  EntityT left, right;
+  bool    outer;
+};
+
+
+// The border edges of a BorderGraph with its coordinates scaled by (scale_x, scale_y): the input for vector-based
+// scaling, with or without simplifying the polylines first.
+template<typename EntityT>
+std::vector< RasterEdge<EntityT> > raster_edges(const BorderGraph<EntityT>& g, double scale_x, double scale_y)
+{
+  std::vector< RasterEdge<EntityT> > edges;
+
+  for (uint e = 0; e < g.n_edges(); ++e)
+  {
+    const auto& ge = g.edge(e);
+    const auto pts = g.points(e);
+
+    for (size_t i = 1; i < pts.size(); ++i)
+      edges.push_back({ pts[i - 1].x * scale_x, pts[i - 1].y * scale_y, pts[i].x * scale_x, pts[i].y * scale_y,
+                        ge.left, ge.right, ge.outer });
+  }
+
+  return edges;
+}
+
+
+namespace raster_detail {
+
+// An edge in the active edge table, normalized to point downward
+template<typename EntityT>
+struct ActiveEdge
+{
+  double  x_top, y_top, dx_dy;
+  uint    first_row, last_row; // scanlines crossed, [first_row, last_row]
+  EntityT east, west;
+  bool    east_out, west_out;  // side is outside the map
+  double  x;                   // crossing of the current scanline
+
+  double x_at(double yc) const noexcept { return x_top + (yc - y_top) * dx_dy; }
+};
+
+// The widest stretch of an entity between two crossings of a scanline which no pixel center fell into, i.e. where
+// the entity would most deserve a pixel if it got none
+struct Sliver
+{
+  double width = -1;
+  uint   x = 0, y = 0;
+};
+
+}
+
+
+// Rasterize the partition into `map`, which must be sized already (and whose rows are overwritten). Horizontal
+// bands of scanlines are rasterized in parallel, each with its own active edge table, and every scanline is
+// emitted directly as segments, so the cost is O(edges + crossings + output segments) rather than per pixel.
+// Scanlines which no edge crosses get EntityT().
+//
+// Entities which occur in the partition but are too thin to cover a single pixel center are forced back in, at
+// the pixel in the middle of their widest sliver on any scanline (or next to one of their vertices, if no scanline
+// crosses them at all), without taking the last pixel of another entity. Returns the entities so forced, ascending.
+
+template<typename EntityT, typename CoordT>
+std::vector<EntityT> rasterize_partition(const std::vector< RasterEdge<EntityT> >& edges,
+                                         SegmentMap<EntityT, CoordT>& map)
+{
+  using namespace raster_detail;
+  using Edge = ActiveEdge<EntityT>;
+
+  const uint width = map.width(), height = map.height();
+
+  /* edge table: normalized edges bucketed by first scanline (horizontal & between-scanline edges dropped) */
+
+  std::vector<Edge> unbucketed;
+  unbucketed.reserve(edges.size());
+
+  for (const auto& re : edges)
+  {
+    if (re.y0 == re.y1)
+      continue;
+
+    const bool down = (re.y1 > re.y0);
+    Edge e;
+    e.x_top = down ? re.x0 : re.x1;
+    e.y_top = down ? re.y0 : re.y1;
+    const double x_bot = down ? re.x1 : re.x0, y_bot = down ? re.y1 : re.y0;
+    e.dx_dy = (x_bot - e.x_top) / (y_bot - e.y_top);
+
+    // Scanline y's center is y + 0.5; the edge covers the centers in [y_top, y_bot)
+    const double first = std::max(0.0, std::ceil(e.y_top - 0.5));
+    const double last = std::min(double(height), std::ceil(y_bot - 0.5)) - 1;
+
+    if (last < first)
+      continue;
+
+    e.first_row = uint(first);
+    e.last_row = uint(last);
+
+    // Walking down, the left-hand side is east; walking up, it's west
+    e.east     = down ? re.left : re.right;
+    e.west     = down ? re.right : re.left;
+    e.east_out = !down && re.outer;
+    e.west_out = down && re.outer;
+    e.x        = 0;
+    unbucketed.push_back(e);
+  }
+
+  // (a counting sort over the scanlines; the edges of scanline y are table[row_start[y], row_start[y + 1]))
+  std::vector<size_t> row_start(size_t(height) + 1, 0);
+
+  for (const auto& e : unbucketed)
+    ++row_start[e.first_row + 1];
+
+  for (uint y = 0; y < height; ++y)
+    row_start[y + 1] += row_start[y];
+
+  std::vector<Edge> table( unbucketed.size() );
+
+  {
+    std::vector<size_t> fill(row_start.begin(), row_start.end() - 1);
+
+    for (const auto& e : unbucketed)
+      table[ fill[e.first_row]++ ] = e;
+  }
+
+  unbucketed = std::vector<Edge>();
+
+  /* entity vertices, for per-entity pixel counts */
+
+  EntitySet<EntityT> id_set;
+
+  for (const auto& re : edges)
+  {
+    id_set.insert(re.left);
+    if (!re.outer) id_set.insert(re.right);
+  }
+
+  const std::vector<EntityT> ids = id_set.sorted();
+
+  const uint n_ids = static_cast<uint>(ids.size());
+  std::vector<uint> dense_vertex;
+
+  if (n_ids > 0 && static_cast<uint64_t>(ids.back()) < (uint64_t(1) << 20))
+  {
+    dense_vertex.resize( static_cast<size_t>(ids.back()) + 1 );
+
+    for (uint v = 0; v < n_ids; ++v)
+      dense_vertex[ static_cast<size_t>(ids[v]) ] = v;
+  }
+
+  auto vertex_of = [&](EntityT id) -> uint
+  {
+    if (!dense_vertex.empty())
+      return dense_vertex[ static_cast<size_t>(id) ];
+
+    return static_cast<uint>( std::lower_bound(ids.begin(), ids.end(), id) - ids.begin() );
+  };
+
+  /* sweep */
+
+  const uint n_max_bands = max_bands(height, 64);
+  std::vector< std::vector<uint64_t> > band_area( n_max_bands );
+  std::vector< std::vector<Sliver> > band_slivers( n_max_bands );
+
+  const uint n_bands = parallel_bands(height, [&](uint band, uint y_begin, uint y_end)
+  {
+    auto& area = band_area[band];
+    auto& slivers = band_slivers[band];
+    area.assign(n_ids, 0);
+    slivers.assign(n_ids, Sliver());
+
+    // Edges which start above the band but reach into it are active from its first scanline
+    auto next = table.begin() + static_cast<ptrdiff_t>(row_start[y_begin]);
+    std::vector<Edge> active;
+
+    for (auto it = table.begin(); it != next; ++it)
+      if (it->last_row >= y_begin)
+        active.push_back(*it);
+
+    std::vector<uint> ends;
+
+    for (uint y = y_begin; y < y_end; ++y)
+    {
+      const double yc = y + 0.5;
+
+      active.erase(std::remove_if(active.begin(), active.end(), [&](const Edge& e) { return e.last_row < y; }),
+                   active.end());
+
+      for (; next != table.end() && next->first_row == y; ++next)
+        active.push_back(*next);
+
+      for (auto& e : active)
+        e.x = e.x_at(yc);
+
+      // Crossings move little from one scanline to the next, so the table stays nearly sorted and insertion sort
+      // is linear in practice. (Edges crossing at the same x can only be ones leaving a common vertex on this
+      // scanline, and ordering those by slope puts them in their order just below it.)
+      auto before = [](const Edge& a, const Edge& b) { return a.x < b.x || (a.x == b.x && a.dx_dy < b.dx_dy); };
+
+      for (size_t i = 1; i < active.size(); ++i)
+        for (size_t k = i; k > 0 && before(active[k], active[k - 1]); --k)
+          std::swap(active[k], active[k - 1]);
+
+      auto& row = map.mutable_row(y);
+      row.clear();
+
+      if (active.empty())
+      {
+        row.emplace_back(EntityT(), static_cast<CoordT>(width));
+        continue;
+      }
+
+      // Pixel x lies east of a crossing at c iff its center x + 0.5 >= c
+      ends.resize(active.size());
+
+      for (size_t k = 0; k < active.size(); ++k)
+        ends[k] = uint( std::clamp(std::ceil(active[k].x - 0.5), 0.0, double(width)) );
+
+      auto emit = [&](EntityT id, uint end)
+      {
+        if (end <= (row.empty() ? 0u : uint(row.back().end))) // (empty span)
+          return;
+
+        if (!row.empty() && row.back().id == id)
+          row.back().end = static_cast<CoordT>(end);
+        else
+          row.emplace_back(id, static_cast<CoordT>(end));
+      };
+
+      auto account = [&](EntityT id, uint x_begin, uint x_end, double c_begin, double c_end)
+      {
+        const uint v = vertex_of(id);
+
+        if (x_end > x_begin)
+          area[v] += x_end - x_begin;
+        else if (c_end - c_begin > slivers[v].width)
+        {
+          const double mid = std::clamp(std::floor((c_begin + c_end) / 2), 0.0, double(width - 1));
+          slivers[v] = { c_end - c_begin, uint(mid), y };
+        }
+      };
+
+      // West of the first crossing: its west side, unless that's the outside
+      const auto& first = active.front();
+      EntityT id = first.west_out ? first.east : first.west;
+      emit(id, ends[0]);
+
+      if (!first.west_out)
+        account(id, 0, ends[0], 0, first.x);
+
+      for (size_t k = 0; k < active.size(); ++k)
+      {
+        const bool last = (k + 1 == active.size());
+        const uint span_end = last ? width : ends[k + 1];
+        const auto& e = active[k];
+
+        if (!e.east_out)
+          id = e.east;
+        else if (!last && !active[k + 1].west_out)
+          id = active[k + 1].west;
+        else if (last && !e.west_out)
+          id = e.west;
+        // (else: outside on both sides, e.g. between two pieces of a broken outline; extend the previous entity)
+
+        emit(id, std::max(span_end, ends[k]));
+
+        if (!e.east_out)
+          account(id, ends[k], std::max(span_end, ends[k]), e.x, last ? double(width) : active[k + 1].x);
+      }
+
+      if (y > y_begin)
+        map.dedup_row(y, y - 1);
+    }
+  }, 64);
+
+  /* force in entities which got no pixel */
+
+  std::vector<uint64_t> area(n_ids, 0);
+  std::vector<Sliver> slivers(n_ids);
+
+  for (uint band = 0; band < n_bands; ++band)
+  {
+    for (uint v = 0; v < n_ids; ++v)
+    {
+      area[v] += band_area[band][v];
+
+      if (band_slivers[band][v].width > slivers[v].width)
+        slivers[v] = band_slivers[band][v];
+    }
+  }
+
+  std::vector<EntityT> forced;
+
+  if (width == 0 || height == 0)
+    return forced;
+
+  for (uint v = 0; v < n_ids; ++v)
+  {
+    if (area[v] > 0)
+      continue;
+
+    uint cx, cy;
+
+    if (slivers[v].width >= 0)
+    {
+      cx = slivers[v].x;
+      cy = slivers[v].y;
+    }
+    else
+    {
+      // Never crossed by a scanline center: take the pixel at the midpoint of one of its edges
+      auto it = std::find_if(edges.begin(), edges.end(),
+                             [&](const auto& re) { return re.left == ids[v] || (!re.outer && re.right == ids[v]); });
+      cx = uint( std::clamp(std::floor((it->x0 + it->x1) / 2), 0.0, double(width - 1)) );
+      cy = uint( std::clamp(std::floor((it->y0 + it->y1) / 2), 0.0, double(height - 1)) );
+    }
+
+    // Prefer the chosen pixel, but don't take the only pixel of another entity
+    const int candidates[5][2] = { {0, 0}, {1, 0}, {-1, 0}, {0, 1}, {0, -1} };
+
+    for (const auto& d : candidates)
+    {
+      const int px = int(cx) + d[0], py = int(cy) + d[1];
+
+      if (px < 0 || py < 0 || px >= int(width) || py >= int(height))
+        continue;
+
+      const EntityT owner = map.id_at(uint(px), uint(py));
+      const uint owner_v = (std::binary_search(ids.begin(), ids.end(), owner)) ? vertex_of(owner) : n_ids;
+
+      if (owner_v < n_ids && area[owner_v] <= 1)
+        continue;
+
+      map.set_id_at(uint(px), uint(py), ids[v]);
+
+      if (owner_v < n_ids) --area[owner_v];
+      area[v] = 1;
+      forced.push_back(ids[v]);
+      break;
+    }
+  }
+
+  return forced;
+}
+
+
+#endif
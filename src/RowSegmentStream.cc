@@ -0,0 +1,129 @@
+#include "RowSegmentStream.h"
+
+#include <algorithm>
+
+#include <ck2/FileLocation.h>
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+RowSegmentStream::RowSegmentStream(const BMPReader& bmp)
+: RowSegmentStream(bmp, 0, bmp.height()) {}
+
+
+RowSegmentStream::RowSegmentStream(const BMPReader& bmp, uint first_row, uint n_rows, size_t read_ahead)
+: _M_bmp(bmp)
+, _M_block(nullptr)
+, _M_rows_per_block( block_rows(bmp, read_ahead) )
+, _M_block_rows(0)
+, _M_block_row(0)
+, _M_row(first_row)
+, _M_end_row(first_row + n_rows)
+, _M_y(0)
+{
+  assert(first_row + n_rows <= bmp.height());
+
+  if (bmp.is_rle())
+  {
+    // RLE rows can't be located without decoding all of the rows before them (see BMPReader)
+    _M_rle.emplace(bmp.path(), bmp._M_hdr.n_bitmap_offset, bmp.rle_size(), bmp.width(), bmp.bpp(), bmp.palette(),
+                   rle_block_size(read_ahead));
+
+    if (!bmp.emits_top_down())
+    {
+      for (uint row = 0; row < first_row; ++row)
+        _M_rle->next_row(_M_segs);
+    }
+    else
+    {
+      // the band's rows are at the end of the data, coming in reverse
+      _M_rle_band.resize(n_rows);
+
+      for (uint row = 0; row < bmp.height() - first_row - n_rows; ++row)
+        _M_rle->next_row(_M_segs);
+
+      for (uint i = n_rows; i-- > 0; )
+        _M_rle->next_row(_M_rle_band[i]);
+
+      _M_rle.reset();
+    }
+
+    return;
+  }
+
+  _M_reader.emplace(bmp.path(),
+                    bmp.band_offset(first_row, n_rows),
+                    static_cast<uint64_t>(n_rows) * bmp._M_row_sz,
+                    static_cast<size_t>(_M_rows_per_block) * bmp._M_row_sz,
+                    BMPReader::READ_DEPTH,
+                    bmp.reads_backward());
+}
+
+
+uint RowSegmentStream::block_rows(const BMPReader& bmp, size_t read_ahead) noexcept
+{
+  const size_t n_rows = read_ahead / BMPReader::READ_DEPTH / bmp._M_row_sz;
+  return static_cast<uint>( std::clamp<size_t>(n_rows, 1, bmp.rows_per_block()) );
+}
+
+
+size_t RowSegmentStream::rle_block_size(size_t read_ahead) noexcept
+{
+  constexpr size_t MIN_BLOCK_SIZE = 4096;
+  return std::clamp<size_t>(read_ahead / RLEDecoder::READ_DEPTH, MIN_BLOCK_SIZE, RLEDecoder::BLOCK_SIZE);
+}
+
+
+size_t RowSegmentStream::buffer_bytes(const BMPReader& bmp, size_t read_ahead) noexcept
+{
+  if (bmp.is_rle())
+    return RLEDecoder::READ_DEPTH * rle_block_size(read_ahead);
+  else
+    return size_t(BMPReader::READ_DEPTH) * block_rows(bmp, read_ahead) * bmp._M_row_sz;
+}
+
+
+bool RowSegmentStream::next()
+{
+  if (_M_row == _M_end_row)
+    return false;
+
+  if (_M_rle || !_M_rle_band.empty())
+  {
+    if (_M_rle)
+      _M_rle->next_row(_M_segs);
+    else
+      _M_segs.swap( _M_rle_band[_M_row - (_M_end_row - _M_rle_band.size())] );
+
+    _M_y = _M_bmp.y_of(_M_row++);
+    return true;
+  }
+
+  if (_M_block_row == _M_block_rows)
+  {
+    const uint n_expected_rows = std::min(_M_rows_per_block, _M_end_row - _M_row);
+
+    size_t block_sz;
+    _M_block = _M_reader->next(block_sz);
+    _M_block_rows = static_cast<uint>( (_M_block) ? block_sz / _M_bmp._M_row_sz : 0 );
+    _M_block_row = 0;
+
+    if (_M_block_rows < n_expected_rows)
+      _M_bmp.throw_eof(_M_row, n_expected_rows, _M_block_rows);
+  }
+
+  // when reading backward, each block's rows are walked last to first
+  const uint i = (_M_bmp.reads_backward()) ? _M_block_rows - 1 - _M_block_row : _M_block_row;
+
+  _M_bmp.scan_row(_M_block + static_cast<size_t>(i) * _M_bmp._M_row_sz, _M_segs);
+  _M_y = _M_bmp.y_of(_M_row);
+
+  ++_M_block_row;
+  ++_M_row;
+  return true;
+}
+
+
+//NAMESPACE_CK2_END;
@@ -0,0 +1,110 @@
+#ifndef MAPSCALER_ROW_SEGMENT_STREAM_H
+#define MAPSCALER_ROW_SEGMENT_STREAM_H
+
+#include <optional>
+#include <vector>
+
+#include "AsyncReader.h"
+#include "BMPReader.h"
+#include "Error.h"
+#include "RLEDecoder.h"
+#include "common.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2; // until it is actually in the lib
+
+
+// Pull-style counterpart to BMPReader::foreach_row_segments: rather than the reader owning the loop, the consumer
+// asks for one row of segments at a time via next(). This means that iteration can be paused at any point and,
+// more importantly, that several aligned bitmaps (e.g., provinces & terrain) can be walked in lockstep in a single
+// pass (see next_all()).
+//
+// Rows are produced in the same order as foreach_row_segments (by default, bottom-to-top; see
+// BMPReader::set_row_order), and the stream also works with range-for:
+//
+//   for (auto [segs, y] : RowSegmentStream(bmp)) { ... }
+
+struct RowSegmentStream
+{
+  struct Row
+  {
+    span<const BMPReader::RowSegment> segments;
+    uint                              y;
+  };
+
+  // By default, a stream reads ahead as much as BMPReader does
+  static constexpr size_t DEFAULT_READ_AHEAD = size_t(BMPReader::READ_DEPTH) * BMPReader::READ_BLOCK_SIZE;
+
+  // Stream `n_rows` rows starting at row `first_row` in emission order (default: the whole bitmap), reading ahead
+  // by about `read_ahead` bytes
+  RowSegmentStream(const BMPReader&);
+  RowSegmentStream(const BMPReader&, uint first_row, uint n_rows, size_t read_ahead = DEFAULT_READ_AHEAD);
+
+  // Bytes of read-ahead buffers that a stream over `bmp` holds given `read_ahead`. Read-ahead is in whole blocks
+  // of whole rows, so it can't go below min_read_ahead().
+  static size_t buffer_bytes(const BMPReader& bmp, size_t read_ahead) noexcept;
+  static size_t min_read_ahead(const BMPReader& bmp) noexcept { return buffer_bytes(bmp, 0); }
+
+  // Advance to the next row. Returns false once all rows have been produced.
+  bool next();
+
+  // The current row (only valid after next() returned true)
+  Row  row()      const noexcept { return { span<const BMPReader::RowSegment>(_M_segs), _M_y }; }
+  auto segments() const noexcept { return span<const BMPReader::RowSegment>(_M_segs); }
+  auto y()        const noexcept { return _M_y; }
+
+  auto& reader() const noexcept { return _M_bmp; }
+
+  /* range-for support (input iteration; the iterator shares the stream's state) */
+
+  struct sentinel {};
+
+  struct iterator
+  {
+    RowSegmentStream* p_stream;
+
+    Row operator*() const noexcept { return p_stream->row(); }
+    iterator& operator++() { if (!p_stream->next()) p_stream = nullptr; return *this; }
+    bool operator!=(sentinel) const noexcept { return p_stream != nullptr; }
+  };
+
+  iterator begin() { return { next() ? this : nullptr }; }
+  sentinel end()   { return {}; }
+
+private:
+  // Rows per read-ahead block (uncompressed bitmaps) & bytes per read-ahead block (RLE bitmaps) for `read_ahead`
+  static uint   block_rows(const BMPReader&, size_t read_ahead) noexcept;
+  static size_t rle_block_size(size_t read_ahead) noexcept;
+
+  const BMPReader&                _M_bmp;
+  std::optional<AsyncReader>      _M_reader;     // uncompressed bitmaps
+  std::optional<RLEDecoder>       _M_rle;        // RLE8/RLE4 bitmaps
+  std::vector< std::vector<BMPReader::RowSegment> > _M_rle_band; // RLE rows decoded ahead (top-down emission)
+  const uint8_t*                  _M_block;      // current block of rows
+  uint                            _M_rows_per_block;
+  uint                            _M_block_rows; // rows in current block
+  uint                            _M_block_row;  // index of next row within the current block
+  uint                            _M_row;        // next row (file order)
+  uint                            _M_end_row;
+  uint                            _M_y;
+  std::vector<BMPReader::RowSegment> _M_segs;
+};
+
+
+// Advance several aligned streams together. Returns true if all of them produced another row; throws if they
+// fall out of step (i.e., their bitmaps' heights or row ranges differ).
+template<typename... StreamT>
+bool next_all(RowSegmentStream& first, StreamT& ...rest)
+{
+  const bool ok = first.next();
+
+  if ( ((rest.next() != ok) || ...) || (ok && ((rest.y() != first.y()) || ...)) )
+    throw Error("Row streams over {} and other bitmaps are not aligned", first.reader().path().generic_string());
+
+  return ok;
+}
+
+
+//NAMESPACE_CK2_END;
+#endif
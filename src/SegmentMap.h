@@ -1,10 +1,18 @@
 #ifndef MAPSCALER_SEGMENT_MAP_H_
 #define MAPSCALER_SEGMENT_MAP_H_
 
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <utility>
 #include <vector>
 
 #include "BMPReader.h"
 #include <ck2/Color.h>
+#include <ck2/common.h>
 #include "common.h"
 
 
@@ -12,13 +20,20 @@
 using namespace ck2; // until it is actually in the lib
 
 
+// Rows are shared copy-on-write: identical consecutive rows (extremely common in ocean & polar areas, and the
+// norm in vertically upscaled maps) may point to the same segment storage. Read-only row access is oblivious to
+// this, while mutable row access transparently gives the row its own storage first. Sweeps which only care about
+// changes between rows can use same_row() to skip duplicated work.
+//
+// All of a map's storage (rows, their segments, and the row table itself) comes from the std::pmr memory resource
+// given at construction, which is typically the Arena of the pipeline stage producing the map. If rows are to be
+// built concurrently, the resource must be thread-safe (Arena and the default resource are).
+
 template<typename EntityT, typename CoordT>
 struct SegmentMap
 {
-  SegmentMap(uint width_, uint height_)
-  : _M_width(width_)
-  , _M_height(height_)
-  , _M_rows(height_) {}
+  using entity_type = EntityT;
+  using coord_type = CoordT;
 
   struct Segment
   {
@@ -27,20 +42,143 @@ struct SegmentMap
 
     Segment() : id(), end(0) {}
     Segment(EntityT id_, CoordT end_) : id(id_), end(end_) {}
+
+    bool operator==(const Segment& o) const noexcept { return id == o.id && end == o.end; }
+    bool operator!=(const Segment& o) const noexcept { return !(*this == o); }
   };
 
-  auto width()  const noexcept { return _M_width; }
-  auto height() const noexcept { return _M_height; } // effectively size() were we to try to be STL-like
+  using Row = std::pmr::vector<Segment>;
+
+  SegmentMap(uint width_, uint height_, std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+  : _M_width(width_)
+  , _M_height(height_)
+  , _M_rows(height_, mr)
+  {
+    for (auto& p_row : _M_rows)
+      p_row = new_row();
+  }
+
+  auto width()    const noexcept { return _M_width; }
+  auto height()   const noexcept { return _M_height; } // effectively size() were we to try to be STL-like
+  auto resource() const noexcept { return _M_rows.get_allocator().resource(); }
+
+  // Rows are read by indexing, on const and non-const maps alike; writing goes through mutable_row(), which first
+  // gives a shared row its own storage (copy-on-write). It isn't an operator[] overload so that a mere read of a
+  // non-const map can't unshare rows, nor reassign a row's pointer under a concurrent reader.
+  const Row& operator[](uint y) const noexcept { return *_M_rows[y]; }
+
+  Row& mutable_row(uint y)
+  {
+    auto& p_row = _M_rows[y];
+
+    if (p_row.use_count() > 1) // copy-on-write
+      p_row = new_row(*p_row);
+
+    return *p_row;
+  }
+
+  // Point query: the entity occupying pixel (x, y). Segments only store their end, so this is a binary search
+  // over the row's segment ends (the first segment whose end lies beyond x is the one containing x).
+  EntityT id_at(uint x, uint y) const noexcept
+  {
+    assert(x < _M_width && y < _M_height);
+    const auto& row = *_M_rows[y];
+    auto it = std::upper_bound(row.begin(), row.end(), x,
+                               [](uint x_, const Segment& seg) { return x_ < seg.end; });
+    assert(it != row.end());
+    return it->id;
+  }
+
+  // Set pixel (x, y) to `id`, splitting the segment it's in (and merging with a neighboring segment of `id`). For
+  // spot fixes; costs O(segments in the row).
+  void set_id_at(uint x, uint y, EntityT id)
+  {
+    assert(x < _M_width && y < _M_height);
+
+    if (id_at(x, y) == id)
+      return;
+
+    auto& row = mutable_row(y);
+    auto it = std::upper_bound(row.begin(), row.end(), x,
+                               [](uint x_, const Segment& seg) { return x_ < seg.end; });
 
-  auto& operator[](uint y) const noexcept { return _M_rows[y]; }
-  auto& operator[](uint y)       noexcept { return _M_rows[y]; }
+    const uint seg_begin = (it == row.begin()) ? 0 : uint(std::prev(it)->end);
+    const Segment old_seg = *it;
+
+    Segment pieces[3];
+    size_t n = 0, i_new;
+
+    if (x > seg_begin)
+      pieces[n++] = Segment(old_seg.id, static_cast<CoordT>(x));
+
+    i_new = static_cast<size_t>(it - row.begin()) + n;
+    pieces[n++] = Segment(id, static_cast<CoordT>(x + 1));
+
+    if (old_seg.end > x + 1)
+      pieces[n++] = old_seg;
+
+    it = row.erase(it);
+    row.insert(it, pieces, pieces + n);
+
+    if (i_new + 1 < row.size() && row[i_new + 1].id == id)
+    {
+      row[i_new].end = row[i_new + 1].end;
+      row.erase(row.begin() + static_cast<ptrdiff_t>(i_new) + 1);
+    }
+
+    if (i_new > 0 && row[i_new - 1].id == id)
+    {
+      row[i_new - 1].end = row[i_new].end;
+      row.erase(row.begin() + static_cast<ptrdiff_t>(i_new));
+    }
+  }
+
+  // True if rows y1 and y2 share storage (and are thus identical). Identical rows which were never deduplicated
+  // don't count; this is a pointer comparison.
+  bool same_row(uint y1, uint y2) const noexcept { return _M_rows[y1] == _M_rows[y2]; }
+
+  // Make row `y` share the storage of row `src_y`.
+  void share_row(uint y, uint src_y) { _M_rows[y] = _M_rows[src_y]; }
+
+  // Make row `y` share the storage of row `src_y` if they are identical. Meant to be called by builders as soon
+  // as row `y` is complete. Returns whether the rows are now shared.
+  bool dedup_row(uint y, uint src_y)
+  {
+    if (_M_rows[y] != _M_rows[src_y] && *_M_rows[y] != *_M_rows[src_y])
+      return false;
+
+    _M_rows[y] = _M_rows[src_y];
+    return true;
+  }
+
+  // Number of distinct row storages (only counting sharing between neighboring rows, which is all we create).
+  uint n_unique_rows() const noexcept
+  {
+    uint n = (_M_height > 0) ? 1 : 0;
+
+    for (uint y = 1; y < _M_height; ++y)
+      if (!same_row(y, y - 1)) ++n;
+
+    return n;
+  }
 
 private:
+  // The row & its control block are allocated together from our resource, and the polymorphic allocator passes
+  // the resource on to the row itself (uses-allocator construction).
+  template<typename... Args>
+  std::shared_ptr<Row> new_row(Args&&... args) const
+  {
+    return std::allocate_shared<Row>( std::pmr::polymorphic_allocator<Row>(resource()), std::forward<Args>(args)... );
+  }
+
   uint _M_width;
   uint _M_height;
-  std::vector< std::vector<Segment> > _M_rows; // y-segments == row of segments == fixed y == y is outer index
+  std::pmr::vector< std::shared_ptr<Row> > _M_rows; // y-segments == row of segments == fixed y == y is outer index
 };
 
 
+using ProvSegmentMap = SegmentMap<prov_id_t, uint16_t>;
+
+
 //NAMESPACE_CK2_END;
 #endif
@@ -0,0 +1,57 @@
+#include "StreamingScaler.h"
+
+#include <memory>
+#include <vector>
+
+#include "Error.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2;
+
+
+StreamingScaler::StreamingScaler(const BMPReader& bmp, const ColorIndex& color_idx, uint scale_x, uint scale_y,
+                                 size_t memory_budget, uint halo_rows)
+: _M_bmp(bmp)
+, _M_color_idx(color_idx)
+, _M_scale_x(scale_x)
+, _M_scale_y(scale_y)
+, _M_halo_rows(halo_rows)
+, _M_band_rows(0)
+, _M_read_ahead(0)
+{
+  assert(scale_x > 0 && scale_y > 0);
+
+  using Row = ProvSegmentMap::Row;
+  constexpr size_t row_overhead = sizeof(std::shared_ptr<Row>) + sizeof(Row) + 32; // + control block, roughly
+
+  const size_t max_row_bytes = bmp.width() * sizeof(ProvSegmentMap::Segment);
+
+  // Per source row: its segments, one scaled copy of them (the other scale_y - 1 output rows are shared) and the
+  // row slots of the scaled band.
+  const size_t per_row = 2 * (max_row_bytes + row_overhead) + scale_y * sizeof(std::shared_ptr<Row>);
+
+  // The row stream's read-ahead gets an eighth of the budget, up to its usual amount (but it can't go below a
+  // block of a row or so).
+  _M_read_ahead = RowSegmentStream::buffer_bytes( bmp, std::min(memory_budget / 8,
+                                                                 RowSegmentStream::DEFAULT_READ_AHEAD) );
+
+  // Plus, regardless of band size: the read-ahead buffers, the stream's row of segments, the writer's scanline
+  // buffer, and the halo rows carried over from one band to the next.
+  const size_t carry_row = max_row_bytes + sizeof(std::vector<ProvSegmentMap::Segment>);
+  const size_t fixed = _M_read_ahead
+                     + static_cast<size_t>(bmp.width()) * (sizeof(BMPReader::RowSegment) + 3 * scale_x) + 8
+                     + 2 * static_cast<size_t>(halo_rows) * carry_row;
+
+  const size_t min_bytes = fixed + (1 + 2 * static_cast<size_t>(halo_rows)) * per_row;
+
+  if (memory_budget < min_bytes)
+    throw Error("Memory budget of {} bytes is too small for streaming this map (need at least {} bytes)",
+                memory_budget, min_bytes);
+
+  const size_t n_rows = (memory_budget - fixed) / per_row - 2 * static_cast<size_t>(halo_rows);
+  _M_band_rows = static_cast<uint>( std::min<size_t>(n_rows, bmp.height()) );
+}
+
+
+//NAMESPACE_CK2_END;
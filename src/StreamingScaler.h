@@ -0,0 +1,138 @@
+#ifndef MAPSCALER_STREAMING_SCALER_H
+#define MAPSCALER_STREAMING_SCALER_H
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "Arena.h"
+#include "BMPReader.h"
+#include "BMPWriter.h"
+#include "ColorIndex.h"
+#include "ProvinceSegmenter.h"
+#include "RowSegmentStream.h"
+#include "SegmentMap.h"
+#include "common.h"
+
+
+//NAMESPACE_CK2;
+using namespace ck2; // until it is actually in the lib
+
+
+// Out-of-core scaling of the provinces map, for outputs which don't fit in memory as a whole. The source bitmap is
+// processed in bands of rows, bottom-to-top (i.e., in file order for both input and output): each band is
+// segmented, handed to a scaling stage, and the scaled rows are written straight to the output BMPWriter before
+// the next band is read. Every band is extended by up to `halo_rows` rows of context on either side for stages
+// which need to see neighboring rows; those rows are scaled along with the band but never written.
+//
+// The whole run reads through a single RowSegmentStream, so rows must be emitted bottom-to-top (see
+// BMPReader::set_row_order). Halo rows shared by neighboring bands are carried over from one band to the next
+// rather than read again.
+//
+// The band height is derived from a memory budget using worst-case segment counts (every pixel its own segment),
+// so peak memory is bounded by the budget regardless of map content and of output size. The stream's read-ahead
+// buffers come out of the budget too (and shrink if it's tight). Each band's maps live in per-stage Arenas (one
+// for segmentation, one for scaling) which are released in one go once the band has been written, so the heap
+// sees a handful of chunk allocations per band rather than several per row.
+
+struct StreamingScaler
+{
+  StreamingScaler(const BMPReader&, const ColorIndex&, uint scale_x, uint scale_y,
+                  size_t memory_budget, uint halo_rows = 0);
+
+  auto out_width()  const noexcept { return _M_bmp.width() * _M_scale_x; }
+  auto out_height() const noexcept { return _M_bmp.height() * _M_scale_y; }
+  auto band_rows()  const noexcept { return _M_band_rows; } // source rows per band, excluding halo
+  auto halo_rows()  const noexcept { return _M_halo_rows; }
+  auto read_ahead() const noexcept { return _M_read_ahead; } // bytes
+
+  // Run the pipeline. `stage(band_map, halo_top, halo_bottom, mr)` must return the scaled band, including its
+  // halo rows (i.e., exactly band_map.height() * scale_y rows), allocated from the memory resource `mr`.
+  // `color_of(id)` resolves province IDs for output.
+  template<typename StageFuncT, typename ColorFuncT>
+  void run(BMPWriter&, const StageFuncT& stage, const ColorFuncT& color_of);
+
+private:
+  const BMPReader&  _M_bmp;
+  const ColorIndex& _M_color_idx;
+  uint              _M_scale_x;
+  uint              _M_scale_y;
+  uint              _M_halo_rows;
+  uint              _M_band_rows;
+  size_t            _M_read_ahead;
+  Arena             _M_segment_arena;
+  Arena             _M_stage_arena;
+};
+
+
+template<typename StageFuncT, typename ColorFuncT>
+void StreamingScaler::run(BMPWriter& writer, const StageFuncT& stage, const ColorFuncT& color_of)
+{
+  assert(writer.width() == out_width() && writer.height() == out_height());
+  assert(!_M_bmp.emits_top_down());
+
+  const uint height = _M_bmp.height();
+  RowSegmentStream stream(_M_bmp, 0, height, _M_read_ahead);
+
+  // Rows of the previous band which this one needs too (the bottom of its halo), top-to-bottom from carry_y
+  std::vector< std::vector<ProvSegmentMap::Segment> > carry;
+  uint carry_y = height;
+
+  for (uint y_end = height; y_end > 0; )
+  {
+    const uint y_begin = (y_end > _M_band_rows) ? y_end - _M_band_rows : 0;
+    const uint halo_top = std::min(_M_halo_rows, y_begin);
+    const uint halo_bottom = std::min(_M_halo_rows, height - y_end);
+    const uint core_rows = y_end - y_begin;
+    const uint band_y = y_begin - halo_top;
+
+    {
+      ProvSegmentMap band(_M_bmp.width(), halo_top + core_rows + halo_bottom, &_M_segment_arena);
+      assert(carry.empty() || carry_y + carry.size() == band_y + band.height());
+
+      for (uint i = static_cast<uint>(carry.size()); i-- > 0; )
+      {
+        const uint map_y = carry_y + i - band_y;
+        band.mutable_row(map_y).assign(carry[i].begin(), carry[i].end());
+
+        if (i + 1 < carry.size())
+          band.dedup_row(map_y, map_y + 1);
+      }
+
+      segment_provinces(stream, _M_color_idx, band, band_y, band.height() - static_cast<uint>(carry.size()));
+
+      const auto scaled = stage(band, halo_top, halo_bottom, static_cast<std::pmr::memory_resource*>(&_M_stage_arena));
+      assert(scaled.width() == out_width() && scaled.height() == band.height() * _M_scale_y);
+
+      // write the band's core rows, bottom-to-top
+      const uint out_begin = halo_top * _M_scale_y;
+      const uint out_end = (halo_top + core_rows) * _M_scale_y;
+
+      for (uint y = out_end; y-- > out_begin; )
+      {
+        if (y + 1 < out_end && scaled.same_row(y, y + 1))
+          writer.repeat_row();
+        else
+          writer.write_segments(scaled[y], color_of);
+      }
+
+      // the next band's halo reaches down to y_begin + its halo_bottom
+      const uint carry_end = y_begin + std::min(_M_halo_rows, height - y_begin);
+      carry.resize( (y_begin > 0) ? carry_end - band_y : 0 );
+      carry_y = band_y;
+
+      for (uint i = 0; i < carry.size(); ++i)
+        carry[i].assign(band[i].begin(), band[i].end());
+    }
+
+    // the band's maps are gone, so their storage can go all at once
+    _M_segment_arena.release();
+    _M_stage_arena.release();
+
+    y_end = y_begin;
+  }
+}
+
+
+//NAMESPACE_CK2_END;
+#endif
@@ -2,33 +2,58 @@
 #define MAPSCALER_TRACER_H
 
 #include <cassert>
+#include <chrono>
 #include <cstdio>
 #include <string>
 #include <string_view>
 #include <utility>
 
 #include "fmt/format.h"
+#include "AllocStats.h"
+#include "PerfCounters.h"
 
 
+// Traces entry & exit of a scope. The exit line reports the scope's wall time; in ALLOC_STATS builds, its heap
+// activity (across all threads): allocations made, bytes allocated, and the high-water mark of live heap bytes;
+// and, once enable_perf_counters() has succeeded, its hardware performance counters.
 template<typename TracerT>
 struct ScopeTracer
 {
   template<typename... Args>
-  constexpr ScopeTracer(TracerT& tracer, std::string_view format, Args&& ...args)
+  ScopeTracer(TracerT& tracer, std::string_view format, Args&& ...args)
     : _M_tracer( tracer )
     , _M_msg( fmt::format(format, std::forward<Args>(args)...) )
   {
     _M_tracer.push("{} {{", _M_msg);
+    _M_start = std::chrono::steady_clock::now();
   }
 
   ~ScopeTracer() noexcept
   {
-    _M_tracer.pop("}} // END: {}", _M_msg);
+    const std::chrono::duration<double, std::milli> ms = std::chrono::steady_clock::now() - _M_start;
+    std::string stats = fmt::format("{:.1f} ms", ms.count());
+
+    if constexpr (ALLOC_STATS_ENABLED)
+    {
+      const auto s = _M_alloc.stats();
+      constexpr double MiB = 1024.0 * 1024.0;
+
+      stats += fmt::format("; {} allocs, {:.1f} MiB allocated, peak {:.1f} MiB live",
+                           s.n_allocs, double(s.n_bytes) / MiB, double(s.peak_bytes) / MiB);
+    }
+
+    if (const auto s = _M_perf.stats(); !s.empty())
+      stats += "; " + format_perf_stats(s);
+
+    _M_tracer.pop("}} // END: {} [{}]", _M_msg, stats);
   }
 
 private:
-  TracerT&          _M_tracer;
-  const std::string _M_msg;
+  TracerT&                              _M_tracer;
+  const std::string                     _M_msg;
+  AllocScope                            _M_alloc;
+  PerfScope                             _M_perf;
+  std::chrono::steady_clock::time_point _M_start;
 };
 
 
@@ -63,6 +88,9 @@ struct Tracer
   template<typename... Args>
   void trace(std::string_view format, Args&& ...args)
   {
+    if (!_M_file) // (tracing disabled at runtime)
+      return;
+
     for (unsigned int u = 0; u < _M_level; ++u)
       fputs(_M_indent, _M_file);
 
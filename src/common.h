@@ -3,6 +3,7 @@
 
 #include <cassert>
 #include <climits>
+#include <cstddef>
 #include <cstdint>
 #include <cstdio>
 #include <limits>
@@ -17,4 +18,30 @@
 typedef unsigned int uint;
 
 
+// Non-owning view of a contiguous array; a stand-in for C++20's std::span.
+template<typename T>
+struct span
+{
+  constexpr span() noexcept : _M_data(nullptr), _M_size(0) {}
+  constexpr span(T* data_, size_t size_) noexcept : _M_data(data_), _M_size(size_) {}
+
+  template<typename ContainerT>
+  constexpr span(ContainerT& c) noexcept : _M_data(c.data()), _M_size(c.size()) {}
+
+  constexpr T*     data()  const noexcept { return _M_data; }
+  constexpr size_t size()  const noexcept { return _M_size; }
+  constexpr bool   empty() const noexcept { return _M_size == 0; }
+  constexpr T*     begin() const noexcept { return _M_data; }
+  constexpr T*     end()   const noexcept { return _M_data + _M_size; }
+  constexpr T&     front() const noexcept { return _M_data[0]; }
+  constexpr T&     back()  const noexcept { return _M_data[_M_size - 1]; }
+
+  constexpr T& operator[](size_t i) const noexcept { return _M_data[i]; }
+
+private:
+  T*     _M_data;
+  size_t _M_size;
+};
+
+
 #endif // MAPSCALER_COMMON_H
@@ -0,0 +1,719 @@
+#include "kernels.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+
+#include "Error.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  define MAPSCALER_X86_KERNELS
+#  include <immintrin.h>
+#endif
+
+
+using namespace ck2;
+
+
+namespace {
+
+/* generic: plain C++, for any CPU (and for the ends of rows too short for a whole vector) */
+
+uint run_end_bgr24_generic(const uint8_t* row, uint x, uint width)
+{
+  const uint8_t* px = row + 3 * static_cast<size_t>(x);
+
+  for (++x; x < width; ++x)
+  {
+    const uint8_t* p = row + 3 * static_cast<size_t>(x);
+
+    if (p[0] != px[0] || p[1] != px[1] || p[2] != px[2])
+      break;
+  }
+
+  return x;
+}
+
+
+uint run_end_idx8_generic(const uint8_t* row, uint x, uint width)
+{
+  const uint8_t index = row[x];
+
+  for (++x; x < width && row[x] == index; ++x)
+    ;
+
+  return x;
+}
+
+
+uint run_end_id16_generic(const uint16_t* row, uint x, uint width)
+{
+  const uint16_t id = row[x];
+
+  for (++x; x < width && row[x] == id; ++x)
+    ;
+
+  return x;
+}
+
+
+void fill_bgr24_generic(uint8_t* dst, uint n, BGR color)
+{
+  for (uint i = 0; i < n; ++i, dst += 3)
+  {
+    dst[0] = color.blue();
+    dst[1] = color.green();
+    dst[2] = color.red();
+  }
+}
+
+
+// Scale2x of pixel x: unless E sits on a straight edge (B == H or D == F), each corner of its 2x2 block takes the
+// color of its two neighbors on that side when they agree.
+//
+//      B          E0 E1
+//    D E F   ->   E2 E3
+//      H
+inline void scale2x_id16_pixel(const uint16_t* above, const uint16_t* row, const uint16_t* below, uint x,
+                               uint width, uint16_t* out0, uint16_t* out1)
+{
+  const uint16_t b = above[x], e = row[x], h = below[x];
+  const uint16_t d = row[(x > 0) ? x - 1 : x], f = row[(x + 1 < width) ? x + 1 : x];
+  const bool corner = (b != h && d != f);
+
+  out0[2 * x]     = (corner && d == b) ? d : e;
+  out0[2 * x + 1] = (corner && b == f) ? f : e;
+  out1[2 * x]     = (corner && d == h) ? d : e;
+  out1[2 * x + 1] = (corner && h == f) ? f : e;
+}
+
+
+void scale2x_id16_generic(const uint16_t* above, const uint16_t* row, const uint16_t* below, uint width,
+                          uint16_t* out0, uint16_t* out1)
+{
+  for (uint x = 0; x < width; ++x)
+    scale2x_id16_pixel(above, row, below, x, width, out0, out1);
+}
+
+
+#ifdef MAPSCALER_X86_KERNELS
+
+// At 3 bytes per pixel, 16 pixels fill exactly 3 SSE vectors (32 pixels, 3 AVX2 vectors; 64 pixels, 3 AVX-512
+// vectors), so a pixel's bytes repeated over 3 vectors form a pattern which lines up with every such group of
+// pixels. Runs of 24bpp pixels are then compared (and filled) a whole group at a time.
+
+// The pattern is built in registers from three 64-bit words: with a period of 3 bytes, it repeats every 24 bytes,
+// i.e. every 3 words, as A B C A B C ...  (Building it in memory & loading it would stall on store forwarding.)
+struct PatternWords
+{
+  uint64_t a, b, c;
+
+  explicit PatternWords(const uint8_t* px) noexcept
+  {
+    const uint64_t v = px[0] | (uint64_t(px[1]) << 8) | (uint64_t(px[2]) << 16);
+    a = v | (v << 24) | (v << 48);                    // bytes 0-7:   0 1 2 0 1 2 0 1
+    b = (v >> 16) | (v << 8) | (v << 32) | (v << 56); // bytes 8-15:  2 0 1 2 0 1 2 0
+    c = (v >> 8) | (v << 16) | (v << 40);             // bytes 16-23: 1 2 0 1 2 0 1 2
+  }
+};
+
+
+// Runs are checked pixel by pixel for this long before any vectors are set up
+constexpr uint PROBE_PIXELS = 8;
+
+inline uint probe_bgr24(const uint8_t* row, uint x, uint width) noexcept
+{
+  return run_end_bgr24_generic(row, x, std::min(width, x + PROBE_PIXELS));
+}
+
+
+// Index of the first pixel of a group whose equality mask (1 bit per byte, LSB first) isn't all ones
+inline uint first_mismatch(uint x, uint64_t eq) noexcept
+{
+  return x + static_cast<uint>(__builtin_ctzll(~eq)) / 3;
+}
+
+
+/* SSE2 */
+
+__attribute__((target("sse2"))) inline __m128i sse_pattern0(const PatternWords& w) { return _mm_set_epi64x(w.b, w.a); }
+__attribute__((target("sse2"))) inline __m128i sse_pattern1(const PatternWords& w) { return _mm_set_epi64x(w.a, w.c); }
+__attribute__((target("sse2"))) inline __m128i sse_pattern2(const PatternWords& w) { return _mm_set_epi64x(w.c, w.b); }
+
+
+__attribute__((target("sse2")))
+uint run_end_bgr24_sse2(const uint8_t* row, uint x, uint width)
+{
+  // short runs are common enough not to bother setting up vectors for them
+  if (uint end_x = probe_bgr24(row, x, width); end_x < x + PROBE_PIXELS)
+    return end_x;
+
+  const uint8_t* px = row + 3 * static_cast<size_t>(x);
+  const PatternWords w(px);
+  const __m128i p0 = sse_pattern0(w), p1 = sse_pattern1(w), p2 = sse_pattern2(w);
+
+  uint i = x + PROBE_PIXELS; // (those matched already)
+
+  for (; i + 16 <= width; i += 16)
+  {
+    auto p = reinterpret_cast<const __m128i*>(row + 3 * static_cast<size_t>(i));
+    const auto m0 = static_cast<uint32_t>( _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p), p0)) );
+    const auto m1 = static_cast<uint32_t>( _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 1), p1)) );
+    const auto m2 = static_cast<uint32_t>( _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p + 2), p2)) );
+
+    if (const uint64_t eq = m0 | (uint64_t(m1) << 16) | (uint64_t(m2) << 32); eq != 0xFFFF'FFFF'FFFF)
+      return first_mismatch(i, eq);
+  }
+
+  for (; i < width; ++i)
+    if (memcmp(row + 3 * static_cast<size_t>(i), px, 3) != 0)
+      return i;
+
+  return width;
+}
+
+
+__attribute__((target("sse2")))
+uint run_end_idx8_sse2(const uint8_t* row, uint x, uint width)
+{
+  const __m128i v = _mm_set1_epi8(static_cast<char>(row[x]));
+  uint i = x + 1;
+
+  for (; i + 16 <= width; i += 16)
+  {
+    auto p = reinterpret_cast<const __m128i*>(row + i);
+    const auto eq = static_cast<uint32_t>( _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128(p), v)) );
+
+    if (eq != 0xFFFF)
+      return i + static_cast<uint>(__builtin_ctz(~eq));
+  }
+
+  for (; i < width && row[i] == row[x]; ++i)
+    ;
+
+  return i;
+}
+
+
+__attribute__((target("sse2")))
+uint run_end_id16_sse2(const uint16_t* row, uint x, uint width)
+{
+  const __m128i v = _mm_set1_epi16(static_cast<short>(row[x]));
+  uint i = x + 1;
+
+  for (; i + 8 <= width; i += 8)
+  {
+    auto p = reinterpret_cast<const __m128i*>(row + i);
+    const auto eq = static_cast<uint32_t>( _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_loadu_si128(p), v)) );
+
+    if (eq != 0xFFFF)
+      return i + static_cast<uint>(__builtin_ctz(~eq)) / 2; // (2 mask bits per pixel)
+  }
+
+  for (; i < width && row[i] == row[x]; ++i)
+    ;
+
+  return i;
+}
+
+
+__attribute__((target("sse2")))
+void fill_bgr24_sse2(uint8_t* dst, uint n, BGR color)
+{
+  const uint8_t px[3] = { color.blue(), color.green(), color.red() };
+  const PatternWords w(px);
+  const __m128i p0 = sse_pattern0(w), p1 = sse_pattern1(w), p2 = sse_pattern2(w);
+
+  for (; n >= 16; n -= 16, dst += 48)
+  {
+    auto p = reinterpret_cast<__m128i*>(dst);
+    _mm_storeu_si128(p, p0);
+    _mm_storeu_si128(p + 1, p1);
+    _mm_storeu_si128(p + 2, p2);
+  }
+
+  fill_bgr24_generic(dst, n, color);
+}
+
+
+// (a where m is all ones, b where it's zero)
+__attribute__((target("sse2"))) inline __m128i sse_select(__m128i m, __m128i a, __m128i b)
+{
+  return _mm_or_si128(_mm_and_si128(m, a), _mm_andnot_si128(m, b));
+}
+
+
+// Scale2x a vector of pixels at a time, each with its left & right neighbors loaded from one pixel over. The
+// first & last pixels of a row (whose neighbors are clamped) are left to the generic code.
+__attribute__((target("sse2")))
+void scale2x_id16_sse2(const uint16_t* above, const uint16_t* row, const uint16_t* below, uint width,
+                       uint16_t* out0, uint16_t* out1)
+{
+  if (width < 2 + 8)
+  {
+    scale2x_id16_generic(above, row, below, width, out0, out1);
+    return;
+  }
+
+  scale2x_id16_pixel(above, row, below, 0, width, out0, out1);
+  uint x = 1;
+
+  for (; x + 8 < width; x += 8)
+  {
+    const __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(above + x));
+    const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(below + x));
+    const __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x));
+    const __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x - 1));
+    const __m128i f = _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + x + 1));
+
+    // (all ones where B != H && D != F)
+    const __m128i corner = _mm_andnot_si128(_mm_or_si128(_mm_cmpeq_epi16(b, h), _mm_cmpeq_epi16(d, f)),
+                                            _mm_set1_epi32(-1));
+
+    const __m128i e0 = sse_select(_mm_and_si128(corner, _mm_cmpeq_epi16(d, b)), d, e);
+    const __m128i e1 = sse_select(_mm_and_si128(corner, _mm_cmpeq_epi16(b, f)), f, e);
+    const __m128i e2 = sse_select(_mm_and_si128(corner, _mm_cmpeq_epi16(d, h)), d, e);
+    const __m128i e3 = sse_select(_mm_and_si128(corner, _mm_cmpeq_epi16(h, f)), f, e);
+
+    auto p0 = reinterpret_cast<__m128i*>(out0 + 2 * x);
+    auto p1 = reinterpret_cast<__m128i*>(out1 + 2 * x);
+    _mm_storeu_si128(p0,     _mm_unpacklo_epi16(e0, e1));
+    _mm_storeu_si128(p0 + 1, _mm_unpackhi_epi16(e0, e1));
+    _mm_storeu_si128(p1,     _mm_unpacklo_epi16(e2, e3));
+    _mm_storeu_si128(p1 + 1, _mm_unpackhi_epi16(e2, e3));
+  }
+
+  for (; x < width; ++x)
+    scale2x_id16_pixel(above, row, below, x, width, out0, out1);
+}
+
+
+/* SSE4.2: same as SSE2, but a group's 3 comparisons are first combined & tested with a single PTEST */
+
+__attribute__((target("sse4.2")))
+uint run_end_bgr24_sse42(const uint8_t* row, uint x, uint width)
+{
+  if (uint end_x = probe_bgr24(row, x, width); end_x < x + PROBE_PIXELS)
+    return end_x;
+
+  const uint8_t* px = row + 3 * static_cast<size_t>(x);
+  const PatternWords w(px);
+  const __m128i p0 = sse_pattern0(w), p1 = sse_pattern1(w), p2 = sse_pattern2(w);
+
+  uint i = x + PROBE_PIXELS; // (those matched already)
+
+  for (; i + 16 <= width; i += 16)
+  {
+    auto p = reinterpret_cast<const __m128i*>(row + 3 * static_cast<size_t>(i));
+    const __m128i c0 = _mm_cmpeq_epi8(_mm_loadu_si128(p), p0);
+    const __m128i c1 = _mm_cmpeq_epi8(_mm_loadu_si128(p + 1), p1);
+    const __m128i c2 = _mm_cmpeq_epi8(_mm_loadu_si128(p + 2), p2);
+
+    if (_mm_test_all_ones(_mm_and_si128(_mm_and_si128(c0, c1), c2)))
+      continue;
+
+    const auto m0 = static_cast<uint32_t>( _mm_movemask_epi8(c0) );
+    const auto m1 = static_cast<uint32_t>( _mm_movemask_epi8(c1) );
+    const auto m2 = static_cast<uint32_t>( _mm_movemask_epi8(c2) );
+    return first_mismatch(i, m0 | (uint64_t(m1) << 16) | (uint64_t(m2) << 32));
+  }
+
+  for (; i < width; ++i)
+    if (memcmp(row + 3 * static_cast<size_t>(i), px, 3) != 0)
+      return i;
+
+  return width;
+}
+
+
+/* AVX2 */
+
+__attribute__((target("avx2")))
+uint run_end_bgr24_avx2(const uint8_t* row, uint x, uint width)
+{
+  if (uint end_x = probe_bgr24(row, x, width); end_x < x + PROBE_PIXELS)
+    return end_x;
+
+  const uint8_t* px = row + 3 * static_cast<size_t>(x);
+  const PatternWords w(px);
+  const __m256i p0 = _mm256_set_epi64x(w.a, w.c, w.b, w.a);
+  const __m256i p1 = _mm256_set_epi64x(w.b, w.a, w.c, w.b);
+  const __m256i p2 = _mm256_set_epi64x(w.c, w.b, w.a, w.c);
+
+  uint i = x + PROBE_PIXELS; // (those matched already)
+
+  for (; i + 32 <= width; i += 32)
+  {
+    auto p = reinterpret_cast<const __m256i*>(row + 3 * static_cast<size_t>(i));
+    const auto m0 = static_cast<uint32_t>( _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(p), p0)) );
+    const auto m1 = static_cast<uint32_t>( _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(p + 1), p1)) );
+    const auto m2 = static_cast<uint32_t>( _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(p + 2), p2)) );
+
+    // 96 bits of mask don't fit in one word, so find the mismatching one
+    if ((m0 & m1 & m2) == 0xFFFF'FFFF)
+      continue;
+    else if (m0 != 0xFFFF'FFFF)
+      return first_mismatch(i, m0 | 0xFFFF'FFFF'0000'0000);
+    else if (m1 != 0xFFFF'FFFF)
+      return i + (32 + static_cast<uint>(__builtin_ctz(~m1))) / 3;
+    else
+      return i + (64 + static_cast<uint>(__builtin_ctz(~m2))) / 3;
+  }
+
+  for (; i < width; ++i)
+    if (memcmp(row + 3 * static_cast<size_t>(i), px, 3) != 0)
+      return i;
+
+  return width;
+}
+
+
+__attribute__((target("avx2")))
+uint run_end_idx8_avx2(const uint8_t* row, uint x, uint width)
+{
+  const __m256i v = _mm256_set1_epi8(static_cast<char>(row[x]));
+  uint i = x + 1;
+
+  for (; i + 32 <= width; i += 32)
+  {
+    auto p = reinterpret_cast<const __m256i*>(row + i);
+    const auto eq = static_cast<uint32_t>( _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256(p), v)) );
+
+    if (eq != 0xFFFF'FFFF)
+      return i + static_cast<uint>(__builtin_ctz(~eq));
+  }
+
+  for (; i < width && row[i] == row[x]; ++i)
+    ;
+
+  return i;
+}
+
+
+__attribute__((target("avx2")))
+uint run_end_id16_avx2(const uint16_t* row, uint x, uint width)
+{
+  const __m256i v = _mm256_set1_epi16(static_cast<short>(row[x]));
+  uint i = x + 1;
+
+  for (; i + 16 <= width; i += 16)
+  {
+    auto p = reinterpret_cast<const __m256i*>(row + i);
+    const auto eq = static_cast<uint32_t>( _mm256_movemask_epi8(_mm256_cmpeq_epi16(_mm256_loadu_si256(p), v)) );
+
+    if (eq != 0xFFFF'FFFF)
+      return i + static_cast<uint>(__builtin_ctz(~eq)) / 2;
+  }
+
+  for (; i < width && row[i] == row[x]; ++i)
+    ;
+
+  return i;
+}
+
+
+__attribute__((target("avx2")))
+void fill_bgr24_avx2(uint8_t* dst, uint n, BGR color)
+{
+  const uint8_t px[3] = { color.blue(), color.green(), color.red() };
+  const PatternWords w(px);
+  const __m256i p0 = _mm256_set_epi64x(w.a, w.c, w.b, w.a);
+  const __m256i p1 = _mm256_set_epi64x(w.b, w.a, w.c, w.b);
+  const __m256i p2 = _mm256_set_epi64x(w.c, w.b, w.a, w.c);
+
+  for (; n >= 32; n -= 32, dst += 96)
+  {
+    auto p = reinterpret_cast<__m256i*>(dst);
+    _mm256_storeu_si256(p, p0);
+    _mm256_storeu_si256(p + 1, p1);
+    _mm256_storeu_si256(p + 2, p2);
+  }
+
+  fill_bgr24_generic(dst, n, color);
+}
+
+
+__attribute__((target("avx2"))) inline __m256i avx2_select(__m256i m, __m256i a, __m256i b)
+{
+  return _mm256_blendv_epi8(b, a, m);
+}
+
+// Store the 16-bit elements of lo & hi interleaved. The unpacks interleave within each 128-bit lane, so the lanes'
+// halves are put back in order on the way out.
+__attribute__((target("avx2"))) inline void avx2_store_interleaved(uint16_t* dst, __m256i lo, __m256i hi)
+{
+  const __m256i a = _mm256_unpacklo_epi16(lo, hi), b = _mm256_unpackhi_epi16(lo, hi);
+  auto p = reinterpret_cast<__m256i*>(dst);
+  _mm256_storeu_si256(p,     _mm256_permute2x128_si256(a, b, 0x20));
+  _mm256_storeu_si256(p + 1, _mm256_permute2x128_si256(a, b, 0x31));
+}
+
+
+__attribute__((target("avx2")))
+void scale2x_id16_avx2(const uint16_t* above, const uint16_t* row, const uint16_t* below, uint width,
+                       uint16_t* out0, uint16_t* out1)
+{
+  if (width < 2 + 16)
+  {
+    scale2x_id16_generic(above, row, below, width, out0, out1);
+    return;
+  }
+
+  scale2x_id16_pixel(above, row, below, 0, width, out0, out1);
+  uint x = 1;
+
+  for (; x + 16 < width; x += 16)
+  {
+    const __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(above + x));
+    const __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(below + x));
+    const __m256i e = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x));
+    const __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x - 1));
+    const __m256i f = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(row + x + 1));
+
+    const __m256i corner = _mm256_andnot_si256(_mm256_or_si256(_mm256_cmpeq_epi16(b, h), _mm256_cmpeq_epi16(d, f)),
+                                               _mm256_set1_epi32(-1));
+
+    const __m256i e0 = avx2_select(_mm256_and_si256(corner, _mm256_cmpeq_epi16(d, b)), d, e);
+    const __m256i e1 = avx2_select(_mm256_and_si256(corner, _mm256_cmpeq_epi16(b, f)), f, e);
+    const __m256i e2 = avx2_select(_mm256_and_si256(corner, _mm256_cmpeq_epi16(d, h)), d, e);
+    const __m256i e3 = avx2_select(_mm256_and_si256(corner, _mm256_cmpeq_epi16(h, f)), f, e);
+
+    avx2_store_interleaved(out0 + 2 * x, e0, e1);
+    avx2_store_interleaved(out1 + 2 * x, e2, e3);
+  }
+
+  for (; x < width; ++x)
+    scale2x_id16_pixel(above, row, below, x, width, out0, out1);
+}
+
+
+/* AVX-512 (F + BW, for byte comparisons into mask registers) */
+
+__attribute__((target("avx512f"))) inline __m512i avx512_pattern0(const PatternWords& w)
+{
+  return _mm512_set_epi64(w.b, w.a, w.c, w.b, w.a, w.c, w.b, w.a);
+}
+
+__attribute__((target("avx512f"))) inline __m512i avx512_pattern1(const PatternWords& w)
+{
+  return _mm512_set_epi64(w.a, w.c, w.b, w.a, w.c, w.b, w.a, w.c);
+}
+
+__attribute__((target("avx512f"))) inline __m512i avx512_pattern2(const PatternWords& w)
+{
+  return _mm512_set_epi64(w.c, w.b, w.a, w.c, w.b, w.a, w.c, w.b);
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+uint run_end_bgr24_avx512(const uint8_t* row, uint x, uint width)
+{
+  if (uint end_x = probe_bgr24(row, x, width); end_x < x + PROBE_PIXELS)
+    return end_x;
+
+  const uint8_t* px = row + 3 * static_cast<size_t>(x);
+  const PatternWords w(px);
+  const __m512i p0 = avx512_pattern0(w), p1 = avx512_pattern1(w), p2 = avx512_pattern2(w);
+
+  uint i = x + PROBE_PIXELS; // (those matched already)
+
+  for (; i + 64 <= width; i += 64)
+  {
+    const uint8_t* p = row + 3 * static_cast<size_t>(i);
+    const uint64_t m0 = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p), p0);
+    const uint64_t m1 = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p + 64), p1);
+    const uint64_t m2 = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(p + 128), p2);
+
+    if ((m0 & m1 & m2) == ~uint64_t(0))
+      continue;
+    else if (m0 != ~uint64_t(0))
+      return first_mismatch(i, m0);
+    else if (m1 != ~uint64_t(0))
+      return i + (64 + static_cast<uint>(__builtin_ctzll(~m1))) / 3;
+    else
+      return i + (128 + static_cast<uint>(__builtin_ctzll(~m2))) / 3;
+  }
+
+  for (; i < width; ++i)
+    if (memcmp(row + 3 * static_cast<size_t>(i), px, 3) != 0)
+      return i;
+
+  return width;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+uint run_end_idx8_avx512(const uint8_t* row, uint x, uint width)
+{
+  const __m512i v = _mm512_set1_epi8(static_cast<char>(row[x]));
+  uint i = x + 1;
+
+  for (; i + 64 <= width; i += 64)
+  {
+    const uint64_t eq = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(row + i), v);
+
+    if (eq != ~uint64_t(0))
+      return i + static_cast<uint>(__builtin_ctzll(~eq));
+  }
+
+  for (; i < width && row[i] == row[x]; ++i)
+    ;
+
+  return i;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+uint run_end_id16_avx512(const uint16_t* row, uint x, uint width)
+{
+  const __m512i v = _mm512_set1_epi16(static_cast<short>(row[x]));
+  uint i = x + 1;
+
+  for (; i + 32 <= width; i += 32)
+  {
+    const uint32_t eq = _mm512_cmpeq_epi16_mask(_mm512_loadu_si512(row + i), v);
+
+    if (eq != 0xFFFF'FFFF)
+      return i + static_cast<uint>(__builtin_ctz(~eq));
+  }
+
+  for (; i < width && row[i] == row[x]; ++i)
+    ;
+
+  return i;
+}
+
+
+__attribute__((target("avx512f,avx512bw")))
+void fill_bgr24_avx512(uint8_t* dst, uint n, BGR color)
+{
+  const uint8_t px[3] = { color.blue(), color.green(), color.red() };
+  const PatternWords w(px);
+  const __m512i p0 = avx512_pattern0(w), p1 = avx512_pattern1(w), p2 = avx512_pattern2(w);
+
+  for (; n >= 64; n -= 64, dst += 192)
+  {
+    _mm512_storeu_si512(dst, p0);
+    _mm512_storeu_si512(dst + 64, p1);
+    _mm512_storeu_si512(dst + 128, p2);
+  }
+
+  fill_bgr24_generic(dst, n, color);
+}
+
+#endif // MAPSCALER_X86_KERNELS
+
+
+const Kernels GENERIC_KERNELS = { ISA::generic, run_end_bgr24_generic, run_end_idx8_generic, run_end_id16_generic,
+                                  fill_bgr24_generic, scale2x_id16_generic };
+
+#ifdef MAPSCALER_X86_KERNELS
+const Kernels SSE2_KERNELS    = { ISA::sse2,   run_end_bgr24_sse2,   run_end_idx8_sse2,   run_end_id16_sse2,
+                                  fill_bgr24_sse2,   scale2x_id16_sse2 };
+const Kernels SSE42_KERNELS   = { ISA::sse42,  run_end_bgr24_sse42,  run_end_idx8_sse2,   run_end_id16_sse2,
+                                  fill_bgr24_sse2,   scale2x_id16_sse2 };
+const Kernels AVX2_KERNELS    = { ISA::avx2,   run_end_bgr24_avx2,   run_end_idx8_avx2,   run_end_id16_avx2,
+                                  fill_bgr24_avx2,   scale2x_id16_avx2 };
+const Kernels AVX512_KERNELS  = { ISA::avx512, run_end_bgr24_avx512, run_end_idx8_avx512, run_end_id16_avx512,
+                                  fill_bgr24_avx512, scale2x_id16_avx2 }; // (AVX2's Scale2x is memory-bound already)
+#endif
+
+
+const Kernels& kernels_for(ISA isa) noexcept
+{
+#ifdef MAPSCALER_X86_KERNELS
+  switch (isa)
+  {
+  case ISA::sse2:   return SSE2_KERNELS;
+  case ISA::sse42:  return SSE42_KERNELS;
+  case ISA::avx2:   return AVX2_KERNELS;
+  case ISA::avx512: return AVX512_KERNELS;
+  default:          break;
+  }
+#endif
+
+  (void)isa;
+  return GENERIC_KERNELS;
+}
+
+
+std::atomic<const Kernels*>& active_kernels() noexcept
+{
+  static std::atomic<const Kernels*> p_kernels( &kernels_for(best_isa()) );
+  return p_kernels;
+}
+
+}
+
+
+const Kernels& kernels() noexcept { return *active_kernels().load(std::memory_order_relaxed); }
+
+
+bool isa_supported(ISA isa) noexcept
+{
+#ifdef MAPSCALER_X86_KERNELS
+  __builtin_cpu_init(); // we may be called during static initialization
+
+  switch (isa)
+  {
+  case ISA::generic: return true;
+  case ISA::sse2:    return __builtin_cpu_supports("sse2");
+  case ISA::sse42:   return __builtin_cpu_supports("sse4.2");
+  case ISA::avx2:    return __builtin_cpu_supports("avx2");
+  case ISA::avx512:  return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw");
+  }
+
+  return false;
+#else
+  return isa == ISA::generic;
+#endif
+}
+
+
+ISA best_isa() noexcept
+{
+  for (auto isa : { ISA::avx512, ISA::avx2, ISA::sse42, ISA::sse2 })
+    if (isa_supported(isa))
+      return isa;
+
+  return ISA::generic;
+}
+
+
+void set_isa(ISA isa)
+{
+  if (!isa_supported(isa))
+    throw Error("This CPU doesn't support the {} instruction set", isa_name(isa));
+
+  active_kernels().store(&kernels_for(isa), std::memory_order_relaxed);
+}
+
+
+const char* isa_name(ISA isa) noexcept
+{
+  switch (isa)
+  {
+  case ISA::generic: return "generic";
+  case ISA::sse2:    return "sse2";
+  case ISA::sse42:   return "sse4.2";
+  case ISA::avx2:    return "avx2";
+  case ISA::avx512:  return "avx512";
+  }
+
+  return "unknown";
+}
+
+
+bool parse_isa(const char* name, ISA& isa) noexcept
+{
+  for (auto i : { ISA::generic, ISA::sse2, ISA::sse42, ISA::avx2, ISA::avx512 })
+  {
+    if (strcmp(name, isa_name(i)) == 0)
+    {
+      isa = i;
+      return true;
+    }
+  }
+
+  return false;
+}
@@ -0,0 +1,57 @@
+#ifndef MAPSCALER_KERNELS_H
+#define MAPSCALER_KERNELS_H
+
+#include <cstdint>
+
+#include <ck2/Color.h>
+#include "common.h"
+
+
+// Runtime-dispatched pixel kernels. Release builds target the baseline x86-64 ISA so that one static binary runs
+// on every mapper's machine, which means the compiler never vectorizes with anything wider than SSE2. Instead,
+// the few loops that touch every pixel are compiled separately for each instruction set below (see kernels.cc),
+// and the best one the CPU supports is picked at startup (overridable for benchmarking with set_isa()).
+//
+// Kernels are called through a table of function pointers; callers should fetch kernels() once per row or band
+// rather than once per call.
+
+// Instruction sets we have kernels for, in increasing order of preference. Anything but `generic` is only
+// available on x86.
+enum class ISA { generic, sse2, sse42, avx2, avx512 };
+
+struct Kernels
+{
+  ISA isa;
+
+  // Index of the first pixel after pixel `x` of the row whose color differs from that of pixel `x`, or `width`
+  // if there's none. 24bpp (BGR) and 8bpp (palette index) pixels, respectively.
+  uint (*run_end_bgr24)(const uint8_t* row, uint x, uint width);
+  uint (*run_end_idx8)(const uint8_t* row, uint x, uint width);
+
+  // Same, for 16-bit pixels (province IDs; see IdRaster)
+  uint (*run_end_id16)(const uint16_t* row, uint x, uint width);
+
+  // Fill `n` 24bpp pixels starting at `dst` with `color`
+  void (*fill_bgr24)(uint8_t* dst, uint n, ck2::BGR color);
+
+  // Scale2x (a.k.a. EPX) of one row of 16-bit pixels (province IDs) into the two output rows `out0` & `out1`,
+  // each 2 * width pixels. `above` & `below` are the neighboring rows (the row itself at the map's edges).
+  void (*scale2x_id16)(const uint16_t* above, const uint16_t* row, const uint16_t* below, uint width,
+                       uint16_t* out0, uint16_t* out1);
+};
+
+const Kernels& kernels() noexcept;
+
+ISA  best_isa() noexcept; // best supported by this CPU
+bool isa_supported(ISA) noexcept;
+
+// Switch to the kernels for the given instruction set. Throws if the CPU doesn't support it.
+void set_isa(ISA);
+
+const char* isa_name(ISA) noexcept;
+
+// Parse an ISA by name ("generic", "sse2", "sse4.2", "avx2", or "avx512"). Returns false if there's no such ISA.
+bool parse_isa(const char* name, ISA&) noexcept;
+
+
+#endif
@@ -1,11 +1,26 @@
+#include <cstdlib>
+#include <cstring>
 #include <memory>
-#include <unordered_map>
 #include <utility>
 #include <vector>
 
+#include "AdjacencyScaler.h"
+#include "Arena.h"
 #include "BMPReader.h"
+#include "BMPWriter.h"
+#include "ChokeDetector.h"
+#include "ColorIndex.h"
+#include "DistanceTransform.h"
+#include "Error.h"
+#include "IdRaster.h"
+#include "MapValidator.h"
+#include "NearestScaler.h"
+#include "PixelArtScaler.h"
+#include "ProvinceSegmenter.h"
 #include "SegmentMap.h"
+#include "StreamingScaler.h"
 #include "Tracer.h"
+#include "kernels.h"
 #include <ck2/AdjacenciesFile.h>
 #include <ck2/BMPHeader.h>
 #include <ck2/Color.h>
@@ -25,6 +40,10 @@ constexpr char const* GAME_PATH = "C:/Program Files (x86)/Steam/steamapps/common
 constexpr char const* MOD_PATH = "C:/git/SWMH-BETA/SWMH";
 constexpr char const* TEST_MOD_PATH = "C:/git/zmod/edgeTest";
 constexpr char const* PROVBMP_TEST_OUTPUT_PATH = "C:/git/MapScaler/tmp/provinces.bmp";
+constexpr char const* ADJACENCIES_TEST_OUTPUT_PATH = "C:/git/MapScaler/tmp/adjacencies.csv";
+
+constexpr uint SCALE_X = 2;
+constexpr uint SCALE_Y = 2;
 
 
 using namespace std;
@@ -47,10 +66,117 @@ static const pair<BGR, prov_id_t> OceanColorMap = {
 };
 
 
-int main()
+// Province upscalers selectable with --scaler
+enum class Scaler { nearest, epx, xbr, sdf };
+
+
+// Scale through an IdRaster with one of the raster-based scalers
+static ProvSegmentMap scale_raster(const ProvSegmentMap& map, Scaler scaler, std::pmr::memory_resource* mr)
+{
+  if (scaler != Scaler::sdf && (SCALE_X != SCALE_Y || SCALE_X < 2 || SCALE_X > 4))
+    throw Error("The pixel-art scalers only scale by 2, 3, or 4 in both directions");
+
+  IdRaster src(map.width(), map.height());
+  to_id_raster(map, src);
+
+  IdRaster out = (scaler == Scaler::sdf) ? scale_sdf(src, map.width() * SCALE_X, map.height() * SCALE_Y)
+               : (scaler == Scaler::xbr) ? scale_xbr(src, SCALE_X)
+               : (SCALE_X == 2) ? scale2x(src)
+               : (SCALE_X == 3) ? scale3x(src)
+               : scale4x(src);
+
+  if (out.width() > numeric_limits<ProvSegmentMap::coord_type>::max())
+    throw Error("Scaled width of {} pixels exceeds the segment coordinate limit of {}",
+                out.width(), numeric_limits<ProvSegmentMap::coord_type>::max());
+
+  ProvSegmentMap scaled(out.width(), out.height(), mr);
+  to_segment_map(out, scaled);
+  return scaled;
+}
+
+
+static void print_usage(FILE* f)
+{
+  fmt::print(f, "MapScaler v{}\n"
+                "Usage: MapScaler [options]\n"
+                "  --validate             Check the provinces bitmap for all defects, print a report, and exit\n"
+                "  --memory-budget=<MiB>  Stream the map through scaling in bands using at most this much memory\n"
+                "  --scaler=<name>        Province upscaler: nearest (the default), epx (Scale2x/3x/4x), xbr, or\n"
+                "                         sdf (signed distance fields); only nearest can stream\n"
+                "  --isa=<name>           Use the pixel kernels for this instruction set rather than the best one\n"
+                "                         this CPU supports (generic, sse2, sse4.2, avx2, or avx512)\n"
+                "  --trace                Print each stage's wall time (and heap usage, in ALLOC_STATS builds)\n"
+                "  --perf                 Also count cycles, instructions, cache & branch misses per stage (Linux;\n"
+                "                         implies --trace)\n",
+             VERSION);
+}
+
+
+int main(int argc, char** argv)
 {
+  bool opt_validate = false;
+  bool opt_trace = false;
+  bool opt_perf = false;
+  size_t opt_memory_budget = 0; // bytes; 0 means everything is done in memory
+  Scaler opt_scaler = Scaler::nearest;
+
+  for (int i = 1; i < argc; ++i)
+  {
+    if (strcmp(argv[i], "--validate") == 0)
+      opt_validate = true;
+    else if (strcmp(argv[i], "--trace") == 0)
+      opt_trace = true;
+    else if (strcmp(argv[i], "--perf") == 0)
+      opt_perf = opt_trace = true;
+    else if (strncmp(argv[i], "--memory-budget=", 16) == 0 && atoi(argv[i] + 16) > 0)
+      opt_memory_budget = static_cast<size_t>(atoi(argv[i] + 16)) << 20;
+    else if (strcmp(argv[i], "--scaler=nearest") == 0)
+      opt_scaler = Scaler::nearest;
+    else if (strcmp(argv[i], "--scaler=epx") == 0)
+      opt_scaler = Scaler::epx;
+    else if (strcmp(argv[i], "--scaler=xbr") == 0)
+      opt_scaler = Scaler::xbr;
+    else if (strcmp(argv[i], "--scaler=sdf") == 0)
+      opt_scaler = Scaler::sdf;
+    else if (ISA isa; strncmp(argv[i], "--isa=", 6) == 0 && parse_isa(argv[i] + 6, isa))
+    {
+      if (!isa_supported(isa))
+      {
+        fmt::print(stderr, "This CPU doesn't support the {} instruction set\n", isa_name(isa));
+        return 1;
+      }
+
+      set_isa(isa);
+    }
+    else if (strcmp(argv[i], "--help") == 0)
+    {
+      print_usage(stdout);
+      return 0;
+    }
+    else
+    {
+      fmt::print(stderr, "Unrecognized option: {}\n", argv[i]);
+      print_usage(stderr);
+      return 1;
+    }
+  }
+
+  if (opt_memory_budget && opt_scaler != Scaler::nearest)
+  {
+    fmt::print(stderr, "Only the nearest scaler can stream (--memory-budget)\n");
+    return 1;
+  }
+
+  // (before any worker threads start, so the counters include theirs)
+  if (std::string why_not; opt_perf && !enable_perf_counters(why_not))
+    fmt::print(stderr, "Warning: hardware performance counters are unavailable: {}\n", why_not);
+
+  Tracer tracer(opt_trace ? stderr : nullptr);
+
   try
   {
+    ScopeTracer total_scope(tracer, "MapScaler");
+
     ck2::VFS vfs{ fs::path(GAME_PATH) };
     vfs.push_mod_path( fs::path(MOD_PATH) );
     //vfs.push_mod_path( fs::path(TEST_MOD_PATH) );
@@ -59,117 +185,116 @@ int main()
     ck2::DefinitionsTable def_tbl(vfs, dm);
     ck2::AdjacenciesFile adj_file(vfs, dm);
     BMPReader bmp( vfs["map" / dm.province_map_path()] );
+    bmp.set_row_order(BMPReader::RowOrder::storage); // nothing here but streaming cares, so read sequentially
 
-    // TODO: check for any failures to insert into color2id_map due to a duplicated color key
-    std::unordered_map<BGR, prov_id_t> color2id_map;
+    ColorIndex color_idx(def_tbl);
+    color_idx.insert(ImpassableColorMap);
+    color_idx.insert(OceanColorMap);
 
-    for (const auto& row : def_tbl)
-      color2id_map.emplace(BGR(row.color.blue(), row.color.green(), row.color.red()), row.id);
+    if (opt_validate)
+    {
+      ScopeTracer scope(tracer, "Validating");
+      MapValidator validator(bmp, color_idx, def_tbl);
+      validator.run();
+      validator.print_report(stdout);
+      return (validator.n_defects() == 0) ? 0 : 1;
+    }
 
-    color2id_map.emplace(ImpassableColorMap);
-    color2id_map.emplace(OceanColorMap);
+    if (!color_idx.duplicates().empty())
+      fmt::print(stderr, "Warning: {} province color(s) are defined more than once (see --validate)\n",
+                 color_idx.duplicates().size());
 
-    SegmentMap<prov_id_t, uint16_t> seg_map(bmp.width(), bmp.height());
+    auto color_of = [&](prov_id_t id)
+    {
+      if (id == OceanColorMap.second)
+        return OceanColorMap.first;
+      else if (id == ImpassableColorMap.second)
+        return ImpassableColorMap.first;
 
-    bmp.foreach_segment(
-      [&](BGR color, uint start_x, uint end_x, uint y)
-      {
-        assert(y < bmp.height());
-        assert(end_x <= bmp.width());
-        assert(end_x > start_x); // end_x should always be one past the actual final pixel
-
-        if (auto it = color2id_map.find(color); it != color2id_map.end())
-        {
-          seg_map[y].emplace_back(it->second, end_x);
-        }
-        else if (end_x - 1 > start_x)
-        {
-          throw FLError(FLoc(bmp.path()),
-                        "Stray color of RGB({}, {}, {}) in provinces bitmap at pixels (x:{} to {}, y:{})",
-                        color.red(), color.green(), color.blue(), start_x, end_x - 1, y);
-        }
-        else
-        {
-          throw FLError(FLoc(bmp.path()),
-                        "Stray color of RGB({}, {}, {}) in provinces bitmap at pixel (x:{}, y:{})",
-                        color.red(), color.green(), color.blue(), start_x, y);
-        }
-      }
-    );
+      auto c = def_tbl[id].color; // currently these are in RGB rather than BGR
+      return BGR(c.blue(), c.green(), c.red());
+    };
 
-    // Prepare output provinces.bmp (no actual scaling yet) ... //
+    if (opt_memory_budget)
+    {
+      ScopeTracer scope(tracer, "Streaming scaler");
+      // Out-of-core mode. Nearest-neighbor scaling needs no halo rows, but later stages will. Adjacencies need
+      // point queries against the whole scaled map, so they aren't handled in this mode yet.
 
-    BMPHeader prov_bmp_hdr;
-    memset(&prov_bmp_hdr, 0, sizeof(prov_bmp_hdr));
+      bmp.set_row_order(BMPReader::RowOrder::bottom_up); // bands go bottom-to-top, like the output
+      StreamingScaler streamer(bmp, color_idx, SCALE_X, SCALE_Y, opt_memory_budget);
+      BMPWriter writer(PROVBMP_TEST_OUTPUT_PATH, streamer.out_width(), streamer.out_height());
 
-    uint n_rows = bmp.height(), n_cols = bmp.width();
-    auto row_sz = ((n_cols * 24 + 31) / 32) * 4;
-    auto bmp_sz = row_sz * n_rows;
-    auto file_sz = static_cast<uint>(sizeof(prov_bmp_hdr) + bmp_sz);
+      fmt::print(stderr, "Streaming in bands of {} rows\n", streamer.band_rows());
 
-    prov_bmp_hdr.magic = BMPHeader::MAGIC;
-    prov_bmp_hdr.n_file_size = file_sz;
-    prov_bmp_hdr.n_bitmap_offset = sizeof(prov_bmp_hdr);
-    prov_bmp_hdr.n_header_size = 40;
-    prov_bmp_hdr.n_width = n_cols;
-    prov_bmp_hdr.n_height = n_rows;
-    prov_bmp_hdr.n_planes = 1;
-    prov_bmp_hdr.n_bpp = 24;
-    prov_bmp_hdr.n_bitmap_size = bmp_sz;
+      streamer.run(writer,
+                   [](const ProvSegmentMap& band, uint, uint, std::pmr::memory_resource* mr)
+                   {
+                     return scale_nearest(band, SCALE_X, SCALE_Y, mr);
+                   },
+                   color_of);
 
-    const auto ferr = FLErrorStaticFactory(FLoc(PROVBMP_TEST_OUTPUT_PATH));
+      writer.close();
+      return 0;
+    }
 
-    unique_fptr ufp( std::fopen(PROVBMP_TEST_OUTPUT_PATH, "wb"), std::fclose );
+    // Each stage's map lives in its own arena, which is dropped wholesale once the next stage is done with it.
+    Arena segment_arena, scale_arena;
 
-    if (!ufp)
-      throw ferr("Failed to open file for writing: {}", strerror(errno));
+    auto scaled_map = [&]
+    {
+      ProvSegmentMap seg_map(bmp.width(), bmp.height(), &segment_arena);
 
-    if (errno = 0; fwrite(&prov_bmp_hdr, sizeof(prov_bmp_hdr), 1, ufp.get()) < 1)
-      throw ferr("Failed to write bitmap header: {}", strerror(errno));
+      {
+        ScopeTracer scope(tracer, "Segmenting provinces");
+        segment_provinces(bmp, color_idx, seg_map);
+      }
+
+      ScopeTracer scope(tracer, "Scaling");
+
+      if (opt_scaler == Scaler::nearest)
+        return scale_nearest(seg_map, SCALE_X, SCALE_Y, &scale_arena);
+      else
+        return scale_raster(seg_map, opt_scaler, &scale_arena);
+    }();
 
-    auto row_buf = std::make_unique<uint8_t[]>(row_sz);
+    segment_arena.release();
 
-    for (int y = (signed)n_rows - 1; y >= 0; --y)
     {
-      const auto& seg_row = seg_map[y];
-      assert( !seg_row.empty() );
+      ScopeTracer scope(tracer, "Checking for chokes");
+      uint n_diagonal = 0, n_narrow = 0;
 
-      uint start_x = 0;
-      auto p_out = &row_buf[0];
+      for (const auto& c : find_chokes(scaled_map))
+        ++(c.kind == ChokeKind::diagonal ? n_diagonal : n_narrow);
 
-      // BLIT BLIT BLIT LIKE THE MADMAN THAT YOU ALWAYS WANTED TO BE!
-      for (auto seg : seg_row)
-      {
-        BGR color;
-
-        if (seg.id == OceanColorMap.second)
-          color = OceanColorMap.first;
-        else if (seg.id == ImpassableColorMap.second)
-          color = ImpassableColorMap.first;
-        else
-        {
-          auto c = def_tbl[seg.id].color; // currently these are in RGB rather than BGR
-          color = BGR(c.blue(), c.green(), c.red());
-        }
-
-        uint x = start_x;
-
-        for (; x < seg.end; ++x, p_out += 3)
-        {
-          p_out[0] = color.blue();
-          p_out[1] = color.green();
-          p_out[2] = color.red();
-        }
-
-        start_x = x;
-      }
+      if (n_diagonal > 0 || n_narrow > 0)
+        fmt::print(stderr, "Warning: the scaled map has {} diagonal-only province link(s) and {} place(s) where a "
+                   "province is only 1 pixel wide\n", n_diagonal, n_narrow);
+    }
 
-      if (errno = 0; fwrite(row_buf.get(), row_sz, 1, ufp.get()) < 1)
-        throw ferr("Failed to write row of bitmap data: {}", strerror(errno));
+    {
+      ScopeTracer scope(tracer, "Scaling adjacencies");
+      AdjacencyScaler adj_scaler(scaled_map, SCALE_X, SCALE_Y);
+      adj_scaler.scale(adj_file);
+      adj_scaler.print_summary();
+      AdjacencyScaler::write(adj_file, ADJACENCIES_TEST_OUTPUT_PATH);
+    }
+
+    // Write output provinces.bmp ... //
+
+    ScopeTracer scope(tracer, "Writing provinces.bmp");
+    BMPWriter writer(PROVBMP_TEST_OUTPUT_PATH, scaled_map.width(), scaled_map.height());
+
+    for (uint y = scaled_map.height(); y-- > 0; )
+    {
+      // A row sharing storage with the row written just before it is identical to it, so it needn't be blitted.
+      if (y + 1 < scaled_map.height() && scaled_map.same_row(y, y + 1))
+        writer.repeat_row();
+      else
+        writer.write_segments(scaled_map[y], color_of);
     }
 
-    if (auto f = ufp.release(); fclose(f) != 0)
-      throw ferr("Failed to complete writing file: {}", strerror(errno));
+    writer.close();
   }
   catch (std::exception& e) {
     fmt::print(stderr, "Fatal error:\n{}\n", e.what());
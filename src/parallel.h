@@ -0,0 +1,88 @@
+#ifndef MAPSCALER_PARALLEL_H
+#define MAPSCALER_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "common.h"
+
+
+// minimal fork-join helpers for the parallel stages. everything we parallelize is a sweep over rows (or over
+// some other dense index range), so contiguous bands of that range per thread is all we need.
+
+
+inline std::atomic<uint>& _thread_count_setting() noexcept
+{
+  static std::atomic<uint> n_threads( std::max(1u, std::thread::hardware_concurrency()) );
+  return n_threads;
+}
+
+inline uint thread_count() noexcept { return _thread_count_setting().load(std::memory_order_relaxed); }
+inline void set_thread_count(uint n) noexcept { _thread_count_setting().store(std::max(1u, n)); }
+
+
+// Split [0, n) into at most thread_count() contiguous bands of at least min_band items each and call
+// fn(band_index, begin, end) for each band concurrently. The calling thread runs the first band itself. Returns
+// the number of bands used, so callers can size per-band result storage with max_bands() beforehand.
+//
+// If any band throws, the first exception is rethrown on the calling thread once all bands have finished.
+
+inline uint max_bands(uint n, uint min_band = 1) noexcept
+{
+  return std::max(1u, std::min(thread_count(), n / std::max(1u, min_band)));
+}
+
+template<typename FuncT>
+uint parallel_bands(uint n, const FuncT& fn, uint min_band = 1)
+{
+  const uint n_bands = max_bands(n, min_band);
+
+  std::exception_ptr first_error;
+  std::mutex error_mutex;
+
+  auto run_band = [&](uint band)
+  {
+    const uint begin = static_cast<uint>( static_cast<unsigned long long>(n) * band / n_bands );
+    const uint end = static_cast<uint>( static_cast<unsigned long long>(n) * (band + 1) / n_bands );
+
+    try {
+      fn(band, begin, end);
+    }
+    catch (...) {
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!first_error) first_error = std::current_exception();
+    }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(n_bands - 1);
+
+  uint band = 1;
+
+  try {
+    for (; band < n_bands; ++band)
+      threads.emplace_back(run_band, band);
+  }
+  catch (...) {
+    // (a thread failed to start: run the bands left over here, as the ones which did start must still be joined)
+    for (; band < n_bands; ++band)
+      run_band(band);
+  }
+
+  run_band(0);
+
+  for (auto& t : threads)
+    t.join();
+
+  if (first_error)
+    std::rethrow_exception(first_error);
+
+  return n_bands;
+}
+
+
+#endif